@@ -0,0 +1,421 @@
+/**
+ * @file encode_bench.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * standalone encoder benchmark, drive make_session / encode with synthetic frames
+ * over a matrix of codec, preset, resolution, slice count and bitrate.
+ *
+ * sunshine-encode-bench [--encoder nvenc|software] [--codecs h264,hevc] [--presets p1,p4]
+ *                       [--resolutions 1280x720,1920x1080] [--slices 1,4] [--bitrates 5000,20000]
+ *                       [--frames 300] [--framerate 60] [--format csv|json] [--output file]
+ *                       [--stream-slices 0|1]
+ *
+ * @version 1.0
+ * @date 2022-08-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_util.h>
+#include <sunshine_config.h>
+
+#include <encoder_device.h>
+#include <encoder_d3d11_device.h>
+#include <encoder_software_device.h>
+#include <encoder_session.h>
+#include <encoder_thread.h>
+
+#include <platform_common.h>
+#include <display_base.h>
+#include <gpu_hw_device.h>
+#include <windows_helper.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_VALUES    16
+
+// block of noise crossing the picture, so that part of every frame is expensive to code
+#define BENCH_NOISE_BLOCK   256
+
+typedef struct _BenchMatrix {
+    char* encoder;
+
+    char* codecs[BENCH_MAX_VALUES];
+    int codec_count;
+
+    /**
+     * @brief
+     * value of the "preset" codec option,
+     * empty list keep the preset of the encoder config
+     */
+    char* presets[BENCH_MAX_VALUES];
+    int preset_count;
+
+    int widths[BENCH_MAX_VALUES];
+    int heights[BENCH_MAX_VALUES];
+    int resolution_count;
+
+    int slices[BENCH_MAX_VALUES];
+    int slice_count;
+
+    int bitrates[BENCH_MAX_VALUES];
+    int bitrate_count;
+
+    int frames;
+    int framerate;
+
+    bool json;
+    char* output;
+}BenchMatrix;
+
+typedef struct _BenchResult {
+    /**
+     * @brief
+     * fps and latency cover convert + encode,
+     * upload of the synthetic picture is not counted
+     */
+    double fps;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+
+    // output bitrate in kbps at the nominal framerate
+    double kbps;
+}BenchResult;
+
+
+static int
+split_list(char* arg,
+           char** out)
+{
+    int count = 0;
+    for(char* token = strtok(arg, ","); token && count < BENCH_MAX_VALUES; token = strtok(NULL, ","))
+        out[count++] = token;
+    return count;
+}
+
+static bool
+parse_args(BenchMatrix* matrix,
+           int argc,
+           char** argv)
+{
+    char* values[BENCH_MAX_VALUES];
+    for(int i = 1; i < argc; i++) {
+        char* key   = argv[i];
+        char* value = i + 1 < argc ? argv[++i] : NULL;
+        if(!value) {
+            fprintf(stderr, "missing value for %s\n", key);
+            return FALSE;
+        }
+
+        if(strcmp(key, "--encoder") == 0) {
+            matrix->encoder = value;
+        } else if(strcmp(key, "--codecs") == 0) {
+            matrix->codec_count = split_list(value, matrix->codecs);
+        } else if(strcmp(key, "--presets") == 0) {
+            matrix->preset_count = split_list(value, matrix->presets);
+        } else if(strcmp(key, "--resolutions") == 0) {
+            int count = split_list(value, values);
+            matrix->resolution_count = 0;
+            for(int j = 0; j < count; j++) {
+                int* width  = &matrix->widths[matrix->resolution_count];
+                int* height = &matrix->heights[matrix->resolution_count];
+                if(sscanf(values[j], "%dx%d", width, height) == 2 && *width > 0 && *height > 0)
+                    matrix->resolution_count++;
+            }
+        } else if(strcmp(key, "--slices") == 0) {
+            int count = split_list(value, values);
+            for(int j = 0; j < count; j++)
+                matrix->slices[j] = MAX(atoi(values[j]), 1);
+            matrix->slice_count = count;
+        } else if(strcmp(key, "--bitrates") == 0) {
+            int count = split_list(value, values);
+            for(int j = 0; j < count; j++)
+                matrix->bitrates[j] = MAX(atoi(values[j]), 1);
+            matrix->bitrate_count = count;
+        } else if(strcmp(key, "--frames") == 0) {
+            matrix->frames = MAX(atoi(value), 1);
+        } else if(strcmp(key, "--framerate") == 0) {
+            matrix->framerate = MAX(atoi(value), 1);
+        } else if(strcmp(key, "--format") == 0) {
+            matrix->json = strcmp(value, "json") == 0;
+        } else if(strcmp(key, "--output") == 0) {
+            matrix->output = value;
+        } else if(strcmp(key, "--stream-slices") == 0) {
+            // software only, one codec instance per slice
+            ENCODER_CONFIG->sw.stream_slices = atoi(value) ? TRUE : FALSE;
+        } else {
+            fprintf(stderr, "unknown option %s\n", key);
+            return FALSE;
+        }
+    }
+
+    return matrix->codec_count && matrix->resolution_count &&
+           matrix->slice_count && matrix->bitrate_count;
+}
+
+/**
+ * @brief
+ * option list is built once per encoder, the bench override the preset in place
+ */
+static void
+set_preset(encoder::CodecConfig* codec,
+           char* preset)
+{
+    for(util::KeyValue* option = codec->options; option && option->type; option++) {
+        if(!option->key || strcmp(option->key, "preset"))
+            continue;
+
+        if(option->type == util::Type::STRING)
+            option->string_value = preset;
+        else
+            option->int_value = atoi(preset);
+    }
+}
+
+/**
+ * @brief
+ * scrolling gradient with a moving block of noise
+ */
+static void
+fill_pattern(display::DisplayBase* display,
+             gpu::ImageGpu* img,
+             uint32* pixels,
+             int index)
+{
+    int width  = img->base.width;
+    int height = img->base.height;
+
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            uint32 r = (byte)(x * 2);
+            uint32 g = (byte)(y - index * 2);
+            uint32 b = (byte)(x + y + index * 4);
+            pixels[y * width + x] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    int block = MIN(BENCH_NOISE_BLOCK, MIN(width, height));
+    int bx = (index * 8) % MAX(width - block, 1);
+    int by = (index * 4) % MAX(height - block, 1);
+    uint32 seed = (uint32)index * 2654435761u + 1;
+    for(int y = by; y < by + block; y++) {
+        for(int x = bx; x < bx + block; x++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            pixels[y * width + x] = 0xFF000000 | (seed & 0xFFFFFF);
+        }
+    }
+
+    helper::device_ctx_lock(display->device_ctx);
+    display->device_ctx->UpdateSubresource(img->texture, 0, NULL, pixels, width * 4, 0);
+    helper::device_ctx_unlock(display->device_ctx);
+}
+
+static int
+compare_double(const void* a,
+               const void* b)
+{
+    double x = *(double*)a;
+    double y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+static bool
+run_case(encoder::Encoder* encoder,
+         platf::Display* display,
+         platf::Image* img,
+         uint32* pixels,
+         encoder::Config* config,
+         int frames,
+         BenchResult* result)
+{
+    util::Buffer* session_buf = encoder::make_session_buffer(img, encoder, display, config);
+    if(!session_buf)
+        return FALSE;
+
+    encoder::Session* session = (encoder::Session*)BUFFER_CLASS->ref(session_buf,NULL);
+    platf::Device* device = session->encode->device;
+    util::QueueArray* packets = QUEUE_ARRAY_CLASS->init();
+
+    double* latency = (double*)malloc(sizeof(double) * frames);
+    double total = 0;
+    uint64 bytes = 0;
+    bool ok = TRUE;
+
+    for(int i = 0; i < frames && ok; i++) {
+        fill_pattern((display::DisplayBase*)display, (gpu::ImageGpu*)img, pixels, i);
+
+        auto start = std::chrono::steady_clock::now();
+        int64 pts  = (int64)i * PTS_CLOCK_RATE / config->framerate;
+        ok = !device->klass->convert(device, img) &&
+             encoder::encode(pts, session_buf, device->frame, packets, NULL, NULL);
+
+        latency[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        total += latency[i];
+
+        while(QUEUE_ARRAY_CLASS->peek(packets)) {
+            int size;
+            util::Buffer* pkt;
+            libav::Packet* packet = (libav::Packet*)QUEUE_ARRAY_CLASS->pop(packets,&pkt,&size);
+            bytes += packet->size;
+            BUFFER_CLASS->unref(pkt);
+        }
+    }
+
+    if(ok) {
+        qsort(latency, frames, sizeof(double), compare_double);
+        result->fps  = total > 0 ? frames * 1000.0 / total : 0;
+        result->p50  = latency[(frames - 1) * 50 / 100];
+        result->p90  = latency[(frames - 1) * 90 / 100];
+        result->p99  = latency[(frames - 1) * 99 / 100];
+        result->max  = latency[frames - 1];
+        result->kbps = bytes * 8.0 * config->framerate / frames / 1000.0;
+    }
+
+    free(latency);
+    QUEUE_ARRAY_CLASS->stop(packets);
+    BUFFER_CLASS->unref(session_buf);
+    BUFFER_CLASS->unref(session_buf);
+    return ok;
+}
+
+static void
+print_result(FILE* out,
+             BenchMatrix* matrix,
+             encoder::Config* config,
+             char* codec,
+             char* preset,
+             BenchResult* result,
+             bool first)
+{
+    if(matrix->json) {
+        fprintf(out, "%s\n  {\"encoder\":\"%s\",\"codec\":\"%s\",\"preset\":\"%s\","
+                     "\"width\":%d,\"height\":%d,\"slices\":%d,\"bitrate\":%d,\"frames\":%d,"
+                     "\"fps\":%.2f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+                     "\"output_kbps\":%.1f}",
+                first ? "" : ",",
+                matrix->encoder, codec, preset,
+                config->width, config->height, config->slicesPerFrame, config->bitrate, matrix->frames,
+                result->fps, result->p50, result->p90, result->p99, result->max, result->kbps);
+        return;
+    }
+
+    fprintf(out, "%s,%s,%s,%d,%d,%d,%d,%d,%.2f,%.3f,%.3f,%.3f,%.3f,%.1f\n",
+            matrix->encoder, codec, preset,
+            config->width, config->height, config->slicesPerFrame, config->bitrate, matrix->frames,
+            result->fps, result->p50, result->p90, result->p99, result->max, result->kbps);
+}
+
+int
+main(int argc,
+     char ** argv)
+{
+    config::get_encoder_config(0,nullptr);
+
+    char h264[] = "h264";
+    char none[] = "";
+    BenchMatrix matrix = {0};
+    matrix.encoder          = ENCODER_CONFIG->encoder;
+    matrix.codecs[0]        = h264;
+    matrix.codec_count      = 1;
+    matrix.widths[0]        = 1920;
+    matrix.heights[0]       = 1080;
+    matrix.resolution_count = 1;
+    matrix.slices[0]        = 1;
+    matrix.slice_count      = 1;
+    matrix.bitrates[0]      = ENCODER_CONFIG->conf.bitrate;
+    matrix.bitrate_count    = 1;
+    matrix.frames           = 300;
+    matrix.framerate        = 60;
+
+    if(!parse_args(&matrix, argc, argv)) {
+        fprintf(stderr, "invalid arguments, see encode_bench.cpp for usage\n");
+        return 1;
+    }
+
+    encoder::Encoder* encoder = strcmp(matrix.encoder, "software") == 0 ? SOFTWARE : NVENC;
+
+    platf::Display* display = platf::tryget_display(encoder->dev_type, ENCODER_CONFIG->output_name, matrix.framerate);
+    if(!display) {
+        LOG_ERROR("unable to create display");
+        return 1;
+    }
+
+    DXGI_FORMAT format = ((display::DisplayBase*)display)->format;
+    if(format != DXGI_FORMAT_B8G8R8A8_UNORM && format != DXGI_FORMAT_R8G8B8A8_UNORM) {
+        LOG_ERROR("synthetic frames need an 8 bit desktop format");
+        return 1;
+    }
+
+    platf::Image* img = display->klass->alloc_img(display);
+    if(!img || display->klass->dummy_img(display,img)) {
+        LOG_ERROR("unable to allocate image");
+        return 1;
+    }
+    uint32* pixels = (uint32*)malloc(sizeof(uint32) * img->width * img->height);
+
+    FILE* out = matrix.output ? fopen(matrix.output, "w") : stdout;
+    if(!out) {
+        LOG_ERROR("unable to open output file");
+        return 1;
+    }
+
+    if(matrix.json)
+        fprintf(out, "[");
+    else
+        fprintf(out, "encoder,codec,preset,width,height,slices,bitrate_kbps,frames,fps,p50_ms,p90_ms,p99_ms,max_ms,output_kbps\n");
+
+    bool first = TRUE;
+    int failed = 0;
+    int preset_count = MAX(matrix.preset_count, 1);
+    for(int c = 0; c < matrix.codec_count; c++)
+    for(int p = 0; p < preset_count; p++)
+    for(int r = 0; r < matrix.resolution_count; r++)
+    for(int s = 0; s < matrix.slice_count; s++)
+    for(int b = 0; b < matrix.bitrate_count; b++) {
+        encoder::Config config = ENCODER_CONFIG->conf;
+        config.videoFormat    = strcmp(matrix.codecs[c], "hevc") == 0 ? 1 : 0;
+        config.width          = matrix.widths[r];
+        config.height         = matrix.heights[r];
+        config.slicesPerFrame = matrix.slices[s];
+        config.bitrate        = matrix.bitrates[b];
+        config.framerate      = matrix.framerate;
+
+        char* preset = matrix.preset_count ? matrix.presets[p] : none;
+        if(matrix.preset_count)
+            set_preset(config.videoFormat ? &encoder->hevc : &encoder->h264, preset);
+
+        BenchResult result = {0};
+        if(!run_case(encoder, display, img, pixels, &config, matrix.frames, &result)) {
+            char log[128] = {0};
+            snprintf(log, sizeof(log), "case %s %s %dx%d failed", matrix.codecs[c], preset, config.width, config.height);
+            LOG_WARNING(log);
+            failed++;
+            continue;
+        }
+
+        print_result(out, &matrix, &config, matrix.codecs[c], preset, &result, first);
+        first = FALSE;
+        fflush(out);
+    }
+
+    if(matrix.json)
+        fprintf(out, "\n]\n");
+    if(matrix.output)
+        fclose(out);
+
+    free(pixels);
+    display->klass->free_img(display, img);
+    display->klass->finalize(display);
+    return failed ? 2 : 0;
+}
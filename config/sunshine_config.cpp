@@ -87,15 +87,37 @@ namespace config
         encoder.gop_size = 20;
         encoder.packet_size = RTSP_TCP_MAX_PACKET_SIZE;
         encoder.framerate = 60;
+        encoder.latency_budget = 0;
+        encoder.intra_refresh_period = 0;
+        encoder.idr_window = 100;
+        encoder.idle_keepalive = 1000;
+        encoder.idle_framerate = 10;
+        encoder.idle_timeout = 2000;
+        encoder.watchdog_timeout = 500;
+        encoder.hevc_fallback = 1;
+        encoder.udp_gso = 0;
+        encoder.udp_zerocopy = 0;
         encoder.dwmflush = 0;
 
         encoder.qp = 28;
 
         encoder.rtp.port = 6000;
 
+        encoder.cache_path = "sunshine_encoder.cache";
+
+        encoder.encoder = "nvenc";
+
         encoder.nv.coder = coder_e::_auto;
         encoder.nv.rc = rc_e::cbr;
-        encoder.nv.rc = preset_e::_default;
+        encoder.nv.preset = preset_e::_default;
+
+        encoder.sw.min_threads = 1;
+        encoder.sw.auto_tune = 1;
+        encoder.sw.calibrate = 0;
+        encoder.sw.preset = "superfast";
+        encoder.sw.tune = "zerolatency";
+        encoder.sw.stripes = 1;
+        encoder.sw.stream_slices = 0;
         
         encoder.conf.width = 1920;
         encoder.conf.height = 1080;
@@ -107,6 +129,8 @@ namespace config
         encoder.conf.numRefFrames = 0;
         encoder.conf.slicesPerFrame = 1;
 
+        encoder.simulcast_count = 0;
+
         init = true;
         return &encoder;
     }
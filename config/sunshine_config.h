@@ -15,6 +15,13 @@
 
 #define RTSP_TCP_MAX_PACKET_SIZE 1472
 
+// encoded payload pool, large enough for most P-frame at high bitrate
+#define ENCODE_POOL_BLOCK_SIZE   (512 * 1024)
+#define ENCODE_POOL_MAX_FREE     16
+
+
+// extra renditions encoded from the same capture
+#define SIMULCAST_MAX            3
 
 #include <encoder_datatype.h>
 
@@ -31,29 +38,101 @@ namespace config
         int port;
     }RTP;
 
-    typedef struct SW {
+    typedef struct _Rendition {
+        /**
+         * @brief 
+         * other fields follow the main stream config
+         */
+        int width;
+        int height;
+        int bitrate;
+    }Rendition;
+
+    typedef struct _Software {
         /**
          * @brief 
          * For software encoder
          */
         int min_threads; // Minimum number of threads/slices for CPU encoding
-    };
+
+        // pick thread count from core count, resolution and framerate
+        bool auto_tune;
+
+        // measure single thread throughput once, result is kept in cache_path
+        bool calibrate;
+
+        char* preset;
+        char* tune;
+
+        /**
+         * @brief 
+         * least number of slices of each picture, encoded by the slice threads of one codec,
+         * the picture stays a single bitstream
+         */
+        int stripes;
+
+        /**
+         * @brief 
+         * experimental, off by default.
+         * encode each of the slicesPerFrame slices by its own codec instance,
+         * a stripe is then sent while the ones below it are still encoding.
+         * every stripe is an independent bitstream on its own rtp stream,
+         * only a receiver that decode each stream and stack the pictures can show it
+         */
+        bool stream_slices;
+    }Software;
 
     typedef struct _Encoder{
         // ffmpeg params
         int qp; // higher == more compression and less quality
 
         Nvidia nv;
+        Software sw;
         RTP rtp;
         encoder::Config conf;
+
+        // lower resolution streams published next to conf
+        Rendition simulcast[SIMULCAST_MAX];
+        int simulcast_count;
         
         char* encoder;
         char* adapter_name;
         char* output_name;
 
+        // persistent encoder probe results, NULL to disable
+        char* cache_path;
+
         int gop_size;
         int packet_size;
         int framerate;
+
+        // ms a capture may be late before skipped slots count as dropped, 0 for one frame interval
+        int latency_budget;
+
+        // frames for a rolling intra refresh to cover the picture, 0 use IDR only
+        int intra_refresh_period;
+
+        // ms after a keyframe during which new keyframe requests are coalesced
+        int idr_window;
+
+        // ms between repeated frames while the screen is unchanged, 0 encode every slot
+        int idle_keepalive;
+
+        // capture rate once the screen stayed unchanged for idle_timeout ms, 0 keep the full rate
+        int idle_framerate;
+        int idle_timeout;
+
+        // ms a capture or codec call may block before its worker is replaced, 0 disable the watchdog
+        int watchdog_timeout;
+
+        // open H.264 instead of HEVC once a session probe found HEVC encode slower than the frame interval
+        bool hevc_fallback;
+
+        // hand runs of full size rtp packets to the kernel as one segmented send (linux gso, windows uso)
+        bool udp_gso;
+
+        // send large frames with MSG_ZEROCOPY, the kernel still copy when the device cannot (linux only, ignored on windows)
+        bool udp_zerocopy;
         bool dwmflush;
     }Encoder;
 
@@ -15,6 +15,7 @@
 #include <platform_common.h>
 
 #include <sunshine_config.h>
+#include <windows_helper.h>
 
 #ifdef _WIN32
 extern "C" {
@@ -61,9 +62,14 @@ namespace encoder {
         device->AddRef();
         ctx->device = device;
 
-        ctx->lock_ctx = (void *)1;
-        ctx->lock     = DO_NOTHING;
-        ctx->unlock   = DO_NOTHING;
+        // the device keep its immediate context alive, the reference is not needed
+        ID3D11DeviceContext* device_ctx = NULL;
+        device->GetImmediateContext(&device_ctx);
+        device_ctx->Release();
+
+        ctx->lock_ctx = device_ctx;
+        ctx->lock     = helper::device_ctx_lock;
+        ctx->unlock   = helper::device_ctx_unlock;
 
         int err = av_hwdevice_ctx_init(ctx_buf);
         if(err) {
@@ -97,7 +103,7 @@ namespace encoder {
         util::KeyValue* hevcpairs = util::new_keyvalue_pairs(5);
         util::keyval_new_intval(hevcpairs,"forced-idr",1);
         util::keyval_new_intval(hevcpairs,"zerolatency",1);
-        util::keyval_new_intval(hevcpairs,"preset",ENCODER_CONFIG->nv.rc);
+        util::keyval_new_intval(hevcpairs,"preset",ENCODER_CONFIG->nv.preset);
         util::keyval_new_intval(hevcpairs,"rc",ENCODER_CONFIG->nv.rc);
         encoder.hevc = CodecConfig {
             "hevc_nvenc",
@@ -105,12 +111,16 @@ namespace encoder {
             hevcpairs,
         };
 
+        util::KeyValue* hevcrefresh = util::new_keyvalue_pairs(1);
+        util::keyval_new_intval(hevcrefresh,"intra-refresh",1);
+        encoder.hevc.intra_refresh = hevcrefresh;
+
         util::KeyValue* h264qp = util::new_keyvalue_pairs(2);
         util::keyval_new_intval(h264qp,"qp",ENCODER_CONFIG->qp);
         util::KeyValue* h264pairs = util::new_keyvalue_pairs(6);
         util::keyval_new_intval(h264pairs,"forced-idr",1);
         util::keyval_new_intval(h264pairs,"zerolatency",1);
-        util::keyval_new_intval(h264pairs,"preset",ENCODER_CONFIG->nv.rc);
+        util::keyval_new_intval(h264pairs,"preset",ENCODER_CONFIG->nv.preset);
         util::keyval_new_intval(h264pairs,"rc",ENCODER_CONFIG->nv.rc);
         util::keyval_new_intval(h264pairs,"coder",ENCODER_CONFIG->nv.coder);
         encoder.h264 = 
@@ -120,6 +130,10 @@ namespace encoder {
             h264pairs,
         };
 
+        util::KeyValue* h264refresh = util::new_keyvalue_pairs(1);
+        util::keyval_new_intval(h264refresh,"intra-refresh",1);
+        encoder.h264.intra_refresh = h264refresh;
+
 
         /**
          * @brief 
@@ -142,6 +156,9 @@ namespace encoder {
          */
         encoder.flags.set().flip();
         encoder.flags[EncodingFlags::DEFAULT] = true;
+
+        // nvenc reconfigure bitrate and vbv on the fly when they change on the context
+        encoder.flags[EncodingFlags::DYNAMIC_BITRATE] = true;
         encoder.make_hw_ctx_func = dxgi_make_hwdevice_ctx;
 
         initialized = true;
@@ -20,6 +20,8 @@ namespace encoder
 {
     Encoder* make_d3d11_encoder();
 
+    libav::BufferRef* dxgi_make_hwdevice_ctx(platf::Device *hwdevice_ctx);
+
 }
 
 
@@ -17,24 +17,89 @@
 
 #include <encoder_session.h>
 #include <encoder_thread.h>
+#include <encoder_tune.h>
 #include <sunshine_rtp.h>
 
+#include <thread>
+#include <time.h>
+
 
 
 
 
 namespace encoder
 {
+    /**
+     * @brief 
+     * in-memory avio sink, probe only need to know the muxer produced output
+     */
+    int
+    probe_sink_write(void* opaque, 
+                     uint8_t* buf, 
+                     int size)
+    {
+        *(int64*)opaque += size;
+        return size;
+    }
+
+    /**
+     * @brief 
+     * wrap packet with the rtp muxer without touching the network
+     * 
+     * @param session 
+     * @param av_packet 
+     * @return bool 
+     */
+    bool
+    validate_rtp_output(Session* session,
+                        libav::Packet* av_packet)
+    {
+        int64 written = 0;
+        libav::FormatContext* fmtctx = avformat_alloc_context();
+        fmtctx->oformat = av_guess_format("rtp",NULL,NULL);
+
+        int avio_size = ENCODER_CONFIG->packet_size;
+        byte* avio_buf = (byte*)av_malloc(avio_size);
+        fmtctx->pb = avio_alloc_context(avio_buf, avio_size, 1, &written, NULL, probe_sink_write, NULL);
+        if(!fmtctx->pb) {
+            LOG_ERROR("Error allocating probe output");
+            av_free(avio_buf);
+            avformat_free_context(fmtctx);
+            return FALSE;
+        }
+
+        // rtp muxer size its packets from the output
+        fmtctx->pb->max_packet_size = ENCODER_CONFIG->packet_size;
+
+        libav::Stream* stream = avformat_new_stream (fmtctx, session->encode->codec);
+        avcodec_parameters_from_context(stream->codecpar,session->encode->context);
+
+        bool ret = TRUE;
+        if (avformat_write_header(fmtctx, NULL) < 0){
+            LOG_ERROR("Error writing header");
+            ret = FALSE;
+        } else if(av_write_frame(fmtctx, av_packet) != 0) {
+            LOG_ERROR("write failed");
+            ret = FALSE;
+        } else {
+            avio_flush(fmtctx->pb);
+            ret = written > 0;
+        }
+
+        av_freep(&fmtctx->pb->buffer);
+        avio_context_free(&fmtctx->pb);
+        avformat_free_context(fmtctx);
+        return ret;
+    }
+
     bool
     validate_config(Encoder* encoder, 
+                    platf::Display* disp,
                     Config* config) 
     {
         int size;
-        int res, ret;
         libav::Packet* av_packet   = NULL;
         libav::Frame* frame = NULL;
-        libav::FormatContext* fmtctx   = NULL;
-        libav::Stream* stream  = NULL;
 
         util::Buffer* obj  = NULL;
         util::Buffer* obj_ses = NULL;
@@ -43,11 +108,6 @@ namespace encoder
         Session* session = NULL;
         platf::Image* img = NULL;
 
-        platf::Display* disp = platf::tryget_display( encoder->dev_type, ENCODER_CONFIG->output_name, config->framerate);
-        if(!disp) 
-            return FALSE;
-        
-
         platf::PixelFormat pix_fmt  = config->dynamicRange == 0 ? 
                                         platf::map_pix_fmt(encoder->static_pix_fmt) : 
                                         platf::map_pix_fmt(encoder->dynamic_pix_fmt);
@@ -61,10 +121,7 @@ namespace encoder
         
         session = make_session(encoder, config, disp->width, disp->height, device);
         if(!session)
-        {
-            session_finalize(session);
             return FALSE;
-        }
         
         img = disp->klass->alloc_img(disp);
         if(!img || disp->klass->dummy_img(disp,img)) 
@@ -75,9 +132,11 @@ namespace encoder
         
         if(device->klass->convert(device,img)) 
         {
+            disp->klass->free_img(disp,img);
             session_finalize(session);
             return FALSE;
         }
+        disp->klass->free_img(disp,img);
         
 
         frame = device->frame;
@@ -86,7 +145,7 @@ namespace encoder
         packets = QUEUE_ARRAY_CLASS->init();
         obj_ses = BUFFER_CLASS->init(session,sizeof(Session),session_finalize);
         while(!QUEUE_ARRAY_CLASS->peek(packets)) {
-            if(!encode(1, obj_ses, frame, packets)) 
+            if(!encode(1, obj_ses, frame, packets, NULL, NULL)) 
             {
                 LOG_ERROR("fail to encode");
                 QUEUE_ARRAY_CLASS->stop(packets);
@@ -111,110 +170,132 @@ namespace encoder
             return FALSE;
         }
 
-        fmtctx = avformat_alloc_context();
-        fmtctx->oformat = av_guess_format("rtp",NULL,NULL);
-        snprintf(fmtctx->filename, sizeof(fmtctx->filename), 
-            "rtp://%s:%d", "localhost", ENCODER_CONFIG->rtp.port);
+        bool ret = validate_rtp_output(session, av_packet);
 
-        stream = avformat_new_stream (fmtctx, session->encode->codec);
+        QUEUE_ARRAY_CLASS->stop(packets);
+        BUFFER_CLASS->unref(obj);
+        BUFFER_CLASS->unref(obj_ses);
+        return ret;
+    }
 
-        avcodec_parameters_from_context(stream->codecpar,session->encode->context);
-        if (fmtctx->oformat->flags & AVFMT_GLOBALHEADER)
-            session->encode->context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    /**
+     * @brief 
+     * every probe own its device and codec context, 
+     * so that they can run side by side
+     */
+    typedef struct _Probe {
+        Encoder* encoder;
+        Config config;
+        bool result;
 
+        // opened once by validate_encoder, probes only make devices on it
+        platf::Display* display;
+    }Probe;
 
-        fmtctx->streams[0] = stream;
-        if (avio_open(&fmtctx->pb, fmtctx->filename, AVIO_FLAG_WRITE) < 0){
-            LOG_ERROR("Error opening output file");
-            avformat_free_context(fmtctx);
-            QUEUE_ARRAY_CLASS->stop(packets);
-            BUFFER_CLASS->unref(obj);
-            BUFFER_CLASS->unref(obj_ses);
-            return FALSE;
-        }
+    #define PROBE_MAX 4
 
-        if (avformat_write_header(fmtctx, NULL) < 0){
-            LOG_ERROR("Error writing header");
-            avformat_free_context(fmtctx);
-            QUEUE_ARRAY_CLASS->stop(packets);
-            BUFFER_CLASS->unref(obj);
-            BUFFER_CLASS->unref(obj_ses);
-            return FALSE;
-        }
+    // consumer nvidia drivers cap the encode sessions open at once (as low as 2)
+    #define HW_PROBE_SESSIONS 2
 
-        res = av_write_frame(fmtctx, av_packet);
-        if(res != 0) {
-            LOG_ERROR("write failed");
-            avformat_free_context(fmtctx);
-            QUEUE_ARRAY_CLASS->stop(packets);
-            BUFFER_CLASS->unref(obj);
-            BUFFER_CLASS->unref(obj_ses);
-            return FALSE;
-        }
+    // seconds a probe result with a failed codec is reused before probing again
+    #define PROBE_FAILURE_TTL 600
 
-        avformat_free_context(fmtctx);
-        QUEUE_ARRAY_CLASS->stop(packets);
-        BUFFER_CLASS->unref(obj);
-        BUFFER_CLASS->unref(obj_ses);
-        return TRUE;
+    void
+    probe_thread(Probe* probe)
+    {
+        probe->result = validate_config(probe->encoder, probe->display, &probe->config);
+    }
+
+    /**
+     * @brief 
+     * run probes in batches, a hardware encoder never get more probes than its session budget
+     */
+    void
+    run_probes(Encoder* encoder,
+               platf::Display* display,
+               Probe* probes, 
+               int count)
+    {
+        int batch = encoder->dev_type != AV_HWDEVICE_TYPE_NONE ? HW_PROBE_SESSIONS : PROBE_MAX;
+        for(int i = 0; i < count; i++) 
+            probes[i].display = display;
+
+        std::thread threads[PROBE_MAX];
+        for(int first = 0; first < count; first += batch) {
+            int last = MIN(first + batch, count);
+            for(int i = first; i < last; i++) 
+                threads[i] = std::thread { probe_thread, probes + i };
+
+            for(int i = first; i < last; i++) 
+                threads[i].join();
+        }
     }
 
     bool 
-    validate_encoder(Encoder* encoder) 
+    probe_encoder(Encoder* encoder,
+                  platf::Display* display) 
     {
         encoder->h264.capabilities.set();
         encoder->hevc.capabilities.set();
 
-        // First, test encoder viability
-        {
-            Config config_max_ref_frames { 1920, 1080, 60, 1000, 1, 1, 1, 0, 0 };
-            Config config_autoselect { 1920, 1080, 60, 1000, 1, 0, 1, 0, 0 };
+        // lazily initialized shaders and color matrices 
+        // must exist before probes start running concurrently
+        platf::get_color();
 
-            retry:
-            auto max_ref_frames_h264 = validate_config(encoder, &config_max_ref_frames);
-            auto autoselect_h264     = validate_config(encoder, &config_autoselect);
+        // software sessions size their threads from a calibration encode, run it once here
+        if(encoder->dev_type == AV_HWDEVICE_TYPE_NONE) {
+            tune_calibrate(&encoder->h264);
+            tune_calibrate(&encoder->hevc);
+        }
 
-            if(!max_ref_frames_h264 && !autoselect_h264 ) {
-                if(encoder->h264.qp && encoder->h264.capabilities[FrameFlags::CBR]) 
-                {
-                    // It's possible the encoder isn't accepting Constant Bit Rate. Turn off CBR and make another attempt
-                    encoder->h264.capabilities.set();
-                    encoder->h264.capabilities[FrameFlags::CBR] = FALSE;
-                    goto retry;
-                }
-                return false;
-            }
+        CodecConfig* codecs[2] = { &encoder->h264, &encoder->hevc };
 
+        // First, test encoder viability, h264 and hevc are probed side by side
+        bool max_ref_frames[2] = { false, false };
+        bool autoselect[2]     = { false, false };
+        bool retry[2]          = { true, true };
+        while(retry[0] || retry[1]) {
+            Probe probes[PROBE_MAX];
+            int index[2] = { -1, -1 };
+            int count = 0;
 
-            encoder->h264.capabilities[FrameFlags::REF_FRAMES_RESTRICT]   = max_ref_frames_h264;
-            encoder->h264.capabilities[FrameFlags::REF_FRAMES_AUTOSELECT] = autoselect_h264;
-            encoder->h264.capabilities[FrameFlags::PASSED]                = true;
-        }
-        
-        {
-            Config config_max_ref_frames { 1920, 1080, 60, 1000, 1, 1, 1, 0, 0 };
-            Config config_autoselect { 1920, 1080, 60, 1000, 1, 0, 1, 0, 0 };
+            for(int format = 0; format < 2; format++) {
+                if(!retry[format])
+                    continue;
+
+                index[format] = count;
+                probes[count++] = Probe { encoder, { 1920, 1080, 60, 1000, 1, 1, 1, format, 0 }, false };
+                probes[count++] = Probe { encoder, { 1920, 1080, 60, 1000, 1, 0, 1, format, 0 }, false };
+            }
+
+            run_probes(encoder, display, probes, count);
 
-            config_max_ref_frames.videoFormat = 1;
-            config_autoselect.videoFormat     = 1;
+            for(int format = 0; format < 2; format++) {
+                if(!retry[format])
+                    continue;
 
-            retry_hevc:
-            auto max_ref_frames_hevc = validate_config(encoder, &config_max_ref_frames);
-            auto autoselect_hevc     = validate_config(encoder, &config_autoselect);
+                retry[format] = false;
+                max_ref_frames[format] = probes[index[format]].result;
+                autoselect[format]     = probes[index[format] + 1].result;
 
-            // If HEVC must be supported, but it is not supported
-            if(!max_ref_frames_hevc && !autoselect_hevc) {
-                if(encoder->hevc.qp && encoder->hevc.capabilities[FrameFlags::CBR]) {
+                CodecConfig* codec = codecs[format];
+                if(!max_ref_frames[format] && !autoselect[format] && 
+                    codec->qp && codec->capabilities[FrameFlags::CBR]) {
                     // It's possible the encoder isn't accepting Constant Bit Rate. Turn off CBR and make another attempt
-                    encoder->hevc.capabilities.set();
-                    encoder->hevc.capabilities[FrameFlags::CBR] = false;
-                    goto retry_hevc;
+                    codec->capabilities.set();
+                    codec->capabilities[FrameFlags::CBR] = false;
+                    retry[format] = true;
                 }
             }
+        }
+
+        if(!max_ref_frames[0] && !autoselect[0]) 
+            return false;
 
-            encoder->hevc.capabilities[FrameFlags::REF_FRAMES_RESTRICT]   = max_ref_frames_hevc ;
-            encoder->hevc.capabilities[FrameFlags::REF_FRAMES_AUTOSELECT] = autoselect_hevc;
-            encoder->hevc.capabilities[FrameFlags::PASSED] = max_ref_frames_hevc || autoselect_hevc;
+        for(int format = 0; format < 2; format++) {
+            codecs[format]->capabilities[FrameFlags::REF_FRAMES_RESTRICT]   = max_ref_frames[format];
+            codecs[format]->capabilities[FrameFlags::REF_FRAMES_AUTOSELECT] = autoselect[format];
+            codecs[format]->capabilities[FrameFlags::PASSED]                = max_ref_frames[format] || autoselect[format];
         }
 
         // test DYNAMIC_RANGE and SLICE
@@ -233,22 +314,141 @@ namespace encoder
                 });
             }
 
-
+            Probe probes[PROBE_MAX];
+            FrameFlags flags[PROBE_MAX];
+            int formats[PROBE_MAX];
+            int count = 0;
             for(auto &[flag, config] : configs) {
-                auto h264 = config;
-                auto hevc = config;
+                for(int format = 0; format < 2; format++) {
+                    if(!codecs[format]->capabilities[FrameFlags::PASSED])
+                        continue;
+
+                    flags[count]   = flag;
+                    formats[count] = format;
+                    probes[count]  = Probe { encoder, config, false };
+                    probes[count].config.videoFormat = format;
+                    count++;
+                }
+            }
+
+            run_probes(encoder, display, probes, count);
 
-                h264.videoFormat = 0;
-                hevc.videoFormat = 1;
+            for(int i = 0; i < count; i++) 
+                codecs[formats[i]]->capabilities[flags[i]] = probes[i].result;
+        }
 
-                encoder->h264.capabilities[flag] = validate_config(encoder, &h264);
-                if(encoder->hevc.capabilities[FrameFlags::PASSED]) {
-                    encoder->hevc.capabilities[flag] = validate_config(encoder, &hevc);
+        return true;
+    }
+
+
+    /**
+     * @brief 
+     * FNV-1a over a NULL terminated option list
+     */
+    uint64
+    hash_options(uint64 hash, 
+                 util::KeyValue* option)
+    {
+        while(option && option->type) {
+            char value[32] = {0};
+            snprintf(value, sizeof(value), "=%d;", option->int_value);
+
+            char* parts[3] = { option->key, 
+                               option->type == util::Type::STRING ? option->string_value : value, 
+                               NULL };
+            for(char** part = parts; *part; part++) {
+                for(char* c = *part; *c; c++) {
+                    hash ^= (byte)*c;
+                    hash *= 0x100000001b3ULL;
                 }
             }
+            option++;
         }
+        return hash;
+    }
 
-        return true;
+    /**
+     * @brief 
+     * everything a probe result depend on: 
+     * encoder definition and options, libavcodec build, adapter and driver
+     * 
+     * @param encoder 
+     * @param display 
+     * @param out 
+     * @param size 
+     * @return bool 
+     */
+    bool
+    encoder_fingerprint(Encoder* encoder,
+                        platf::Display* display,
+                        char* out,
+                        int size)
+    {
+        char adapter[256] = "none";
+        if(encoder->dev_type != AV_HWDEVICE_TYPE_NONE &&
+           platf::adapter_fingerprint(display, adapter, sizeof(adapter)))
+            return FALSE;
+
+        uint64 options = 0xcbf29ce484222325ULL;
+        options = hash_options(options, encoder->h264.qp);
+        options = hash_options(options, encoder->h264.options);
+        options = hash_options(options, encoder->hevc.qp);
+        options = hash_options(options, encoder->hevc.options);
+
+        snprintf(out, size, "capabilities:%s:%s:%s:%u:%s:%lu:%016llx",
+                 encoder->name,
+                 encoder->h264.name,
+                 encoder->hevc.name,
+                 avcodec_version(),
+                 adapter,
+                 encoder->flags.to_ulong(),
+                 (unsigned long long)options);
+        return TRUE;
     }
 
+    bool 
+    validate_encoder(Encoder* encoder) 
+    {
+        // probing open display, device and codec up to eight times,
+        // reuse the last result as long as nothing it depend on has changed.
+        // a failure may be transient (sessions held by another process), it is only kept for a while
+        // probes and the adapter fingerprint share one display, closed before any session open its own
+        platf::Display* display = platf::tryget_display(encoder->dev_type, 
+                                                        ENCODER_CONFIG->output_name, 
+                                                        ENCODER_CONFIG->framerate);
+        if(!display)
+            return false;
+
+        char key[CACHE_MAX_LINE / 2] = {0};
+        char value[64] = {0};
+        bool cacheable = encoder_fingerprint(encoder, display, key, sizeof(key));
+
+        unsigned long long h264, hevc;
+        long long failed_at;
+        if(cacheable && 
+           util::cache_get(ENCODER_CONFIG->cache_path, key, value, sizeof(value)) &&
+           sscanf(value, "%llx %llx %lld", &h264, &hevc, &failed_at) == 3 &&
+           (!failed_at || (long long)time(NULL) - failed_at < PROBE_FAILURE_TTL)) {
+            encoder->h264.capabilities = std::bitset<FrameFlags::MAX_FLAGS_FRAME>(h264);
+            encoder->hevc.capabilities = std::bitset<FrameFlags::MAX_FLAGS_FRAME>(hevc);
+            display->klass->finalize(display);
+            return encoder->h264.capabilities[FrameFlags::PASSED];
+        }
+
+        bool passed = probe_encoder(encoder, display);
+        display->klass->finalize(display);
+        if(!passed)
+            encoder->h264.capabilities[FrameFlags::PASSED] = false;
+
+        if(cacheable) {
+            bool complete = encoder->h264.capabilities[FrameFlags::PASSED] && 
+                            encoder->hevc.capabilities[FrameFlags::PASSED];
+            snprintf(value, sizeof(value), "%llx %llx %lld", 
+                     (unsigned long long)encoder->h264.capabilities.to_ullong(),
+                     (unsigned long long)encoder->hevc.capabilities.to_ullong(),
+                     complete ? 0LL : (long long)time(NULL));
+            util::cache_set(ENCODER_CONFIG->cache_path, key, value);
+        }
+        return passed;
+    }
 }
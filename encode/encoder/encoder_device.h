@@ -32,6 +32,7 @@ namespace encoder
         H264_ONLY,              // When HEVC is to heavy
         LIMITED_GOP_SIZE,       // Some encoders don't like it when you have an infinite GOP_SIZE. *cough* VAAPI *cough*
         SINGLE_SLICE_ONLY,      // Never use multiple slices <-- Older intel iGPU's ruin it for everyone else :P
+        DYNAMIC_BITRATE,        // Rate control can be changed on an open codec without a new IDR
         MAX_FLAGS_ENCODING
     }EncodingFlags;
 
@@ -61,6 +62,28 @@ namespace encoder
         util::KeyValue* options;
 
         std::bitset<FrameFlags::MAX_FLAGS_FRAME> capabilities;
+
+        /**
+         * @brief 
+         * NULL terminated, options that turn on periodic intra refresh,
+         * the refresh period is taken from gop_size.
+         * NULL when the codec has no intra refresh
+         */
+        util::KeyValue* intra_refresh;
+
+        /**
+         * @brief 
+         * single thread throughput in pixel per second measured by tune_calibrate,
+         * 0 until the calibration ran
+         */
+        int64 throughput;
+
+        /**
+         * @brief 
+         * rate control of this codec only change with a new codec,
+         * even when the encoder has DYNAMIC_BITRATE
+         */
+        bool fixed_rate;
     }CodecConfig;
 
     struct _Encoder{
@@ -0,0 +1,105 @@
+/**
+ * @file encoder_software_device.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <encoder_software_device.h>
+#include <encoder_d3d11_device.h>
+#include <sunshine_util.h>
+
+#include <encoder_device.h>
+#include <platform_common.h>
+
+#include <sunshine_config.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace encoder {
+
+    Encoder*
+    make_software_encoder()
+    {
+        static bool initialized = false;
+        static Encoder encoder = {0};
+        if (initialized)
+            return &encoder;
+        
+        encoder.name = "software";
+        encoder.profile = 
+        { 
+            FF_PROFILE_H264_HIGH, 
+            FF_PROFILE_HEVC_MAIN, 
+            FF_PROFILE_HEVC_MAIN_10 
+        };
+
+        util::KeyValue* hevcqp = util::new_keyvalue_pairs(1);
+        util::keyval_new_intval(hevcqp,"qp",ENCODER_CONFIG->qp);
+        util::KeyValue* hevcpairs = util::new_keyvalue_pairs(4);
+        util::keyval_new_intval(hevcpairs,"forced-idr",1);
+        util::keyval_new_strval(hevcpairs,"x265-params","info=0:keyint=-1");
+        util::keyval_new_strval(hevcpairs,"preset",ENCODER_CONFIG->sw.preset);
+        util::keyval_new_strval(hevcpairs,"tune",ENCODER_CONFIG->sw.tune);
+        encoder.hevc = CodecConfig {
+            "libx265",
+            hevcqp,
+            hevcpairs,
+        };
+
+        // the libx265 wrapper never forward a new bitrate to x265_encoder_reconfig
+        encoder.hevc.fixed_rate = true;
+
+        util::KeyValue* h264qp = util::new_keyvalue_pairs(1);
+        util::keyval_new_intval(h264qp,"qp",ENCODER_CONFIG->qp);
+        util::KeyValue* h264pairs = util::new_keyvalue_pairs(2);
+        util::keyval_new_strval(h264pairs,"preset",ENCODER_CONFIG->sw.preset);
+        util::keyval_new_strval(h264pairs,"tune",ENCODER_CONFIG->sw.tune);
+        encoder.h264 = 
+        {
+            "libx264",
+            h264qp,
+            h264pairs,
+        };
+
+        // x265 only expose intra refresh through x265-params, keep IDR there
+        util::KeyValue* h264refresh = util::new_keyvalue_pairs(1);
+        util::keyval_new_intval(h264refresh,"intra-refresh",1);
+        encoder.h264.intra_refresh = h264refresh;
+
+
+        /**
+         * @brief 
+         * codec take system memory frame, 
+         * capture still go through the d3d11 converter which output dev_pix_fmt
+         */
+        encoder.dev_type = AV_HWDEVICE_TYPE_NONE;
+        encoder.dev_pix_fmt = AV_PIX_FMT_D3D11;
+        encoder.static_pix_fmt = AV_PIX_FMT_NV12; 
+        encoder.dynamic_pix_fmt = AV_PIX_FMT_P010;
+
+
+        /**
+         * @brief 
+         * make device and encoding options
+         */
+        encoder.flags.set().flip();
+        encoder.flags[EncodingFlags::DEFAULT] = true;
+
+        // streamed slices split the frame between independent instances
+        encoder.flags[EncodingFlags::PARALLEL_ENCODING] = true;
+
+        // libx264 apply bit_rate, rc_max_rate and rc_buffer_size through x264_encoder_reconfig
+        encoder.flags[EncodingFlags::DYNAMIC_BITRATE] = true;
+        encoder.make_hw_ctx_func = dxgi_make_hwdevice_ctx;
+
+        initialized = true;
+        encoder::validate_encoder(&encoder);
+        return &encoder;
+    }
+}
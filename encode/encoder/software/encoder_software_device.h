@@ -0,0 +1,31 @@
+/**
+ * @file encoder_software_device.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __ENCODER_SOFTWARE_DEVICE_H__
+#define __ENCODER_SOFTWARE_DEVICE_H__
+#include <sunshine_util.h>
+#include <encoder_device.h>
+
+
+#define SOFTWARE encoder::make_software_encoder()
+
+namespace encoder
+{
+    /**
+     * @brief 
+     * libx264/libx265 encoder, 
+     * frames are converted on the gpu then downloaded to system memory
+     */
+    Encoder* make_software_encoder();
+
+}
+
+
+#endif
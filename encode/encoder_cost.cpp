@@ -0,0 +1,50 @@
+/**
+ * @file encoder_cost.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <encoder_cost.h>
+#include <sunshine_util.h>
+
+#include <chrono>
+#include <string.h>
+
+namespace encoder
+{
+    void
+    cost_monitor_reset(CostMonitor* monitor,
+                       int framerate)
+    {
+        memset(monitor,0,sizeof(CostMonitor));
+        monitor->budget = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds { 1 }).count() /
+                          MAX(framerate, 1);
+    }
+
+    bool
+    cost_monitor_add(CostMonitor* monitor,
+                     int64 elapsed_ns)
+    {
+        if(monitor->judged)
+            return FALSE;
+
+        if(monitor->warmup < COST_WARMUP_FRAMES) {
+            monitor->warmup++;
+            return FALSE;
+        }
+
+        monitor->frames++;
+        if(elapsed_ns > monitor->budget)
+            monitor->over++;
+
+        if(monitor->frames < COST_WINDOW_FRAMES)
+            return FALSE;
+
+        monitor->judged = TRUE;
+        return monitor->over * 100 >= monitor->frames * COST_OVER_PERCENT;
+    }
+} // namespace encoder
@@ -0,0 +1,52 @@
+/**
+ * @file encoder_cost.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __ENCODER_COST_H__
+#define __ENCODER_COST_H__
+
+#include <sunshine_util.h>
+
+// first frames after open include the keyframe and rate control settling
+#define COST_WARMUP_FRAMES      30
+
+// frames judged together, and the share of them that must be over budget
+#define COST_WINDOW_FRAMES      120
+#define COST_OVER_PERCENT       80
+
+namespace encoder
+{
+    /**
+     * @brief
+     * per frame encode time against the frame interval,
+     * frames are judged by window so that a single slow keyframe does not count.
+     * only the first window after warmup is judged, the codec of a stream 
+     * can only be chosen before its receivers started decoding it
+     */
+    typedef struct _CostMonitor {
+        int64 budget;
+
+        int warmup;
+        int frames;
+        int over;
+        bool judged;
+    }CostMonitor;
+
+    void                cost_monitor_reset      (CostMonitor* monitor,
+                                                 int framerate);
+
+    /**
+     * @brief
+     * return TRUE once the probe window of frames mostly ran over the budget
+     */
+    bool                cost_monitor_add        (CostMonitor* monitor,
+                                                 int64 elapsed_ns);
+} // namespace encoder
+
+#endif
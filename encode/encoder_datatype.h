@@ -14,8 +14,19 @@
 #include <sunshine_util.h>
 #include <platform_common.h>
 
+// codec and RTP share the 90 kHz video clock, pts is the capture time on it
+#define PTS_CLOCK_RATE 90000
+
 namespace encoder
 {    
+    /**
+     * @brief 
+     * take the encoded packets as soon as they may leave, 
+     * the sink pop from packets what it keep
+     */
+    typedef void (*PacketSink) (util::QueueArray* packets,
+                                pointer data);
+
     /**
      * @brief 
      * 
@@ -26,16 +37,16 @@ namespace encoder
         libav::Codec* codec;
 
         platf::Device* device;
-    };
 
+        /**
+         * @brief 
+         * encoded bitstream is written directly into this pool
+         * when the encoder support AV_CODEC_CAP_DR1
+         */
+        util::BufferPool* pool;
+    };
 
-    struct _Session {
-        int64 pts;
 
-        // encoder::EncodeContext encode;
-        EncodeContext* encode;
-    };
-    
     struct _Config{
         int width;
         int height;
@@ -48,6 +59,45 @@ namespace encoder
         int dynamicRange;
     };
 
+    struct _Session {
+        int64 pts;
+
+        // encoder::EncodeContext encode;
+        EncodeContext* encode;
+
+        Encoder* encoder;
+
+        /**
+         * @brief 
+         * config currently applied on the codec,
+         * open_framerate is the framerate rate control was opened with
+         */
+        Config config;
+        int open_framerate;
+        bool hardware;
+
+        /**
+         * @brief 
+         * software encoder only, 
+         * gpu converted capture is downloaded here before encoding
+         */
+        libav::Frame* sw_frame;
+
+        /**
+         * @brief 
+         * set when the codec does not take the sw_frame format,
+         * sw_frame is converted into codec_frame before encoding
+         */
+        libav::Frame* codec_frame;
+        libav::ScaleContext* sws;
+
+        /**
+         * @brief 
+         * not NULL when encoding is split between parallel instances
+         */
+        StripeGroup* stripes;
+    };
+
 } // namespace encoder
 
 
@@ -0,0 +1,73 @@
+/**
+ * @file encoder_fallback.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <encoder_fallback.h>
+
+#include <sunshine_util.h>
+#include <sunshine_config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+namespace encoder
+{
+    /**
+     * @brief
+     * decision hold for one encoder on one adapter and driver, at one stream size
+     */
+    static bool
+    fallback_key(Encoder* encoder,
+                 platf::Display* display,
+                 Config* config,
+                 char* out,
+                 int size)
+    {
+        char adapter[256] = "none";
+        if(encoder->dev_type != AV_HWDEVICE_TYPE_NONE &&
+           platf::adapter_fingerprint(display, adapter, sizeof(adapter)))
+            return FALSE;
+
+        snprintf(out, size, "h264_only:%s:%s:%s:%dx%d@%d",
+                 encoder->name,
+                 encoder->hevc.name,
+                 adapter,
+                 config->width,
+                 config->height,
+                 config->framerate);
+        return TRUE;
+    }
+
+    bool
+    h264_only(Encoder* encoder,
+              platf::Display* display,
+              Config* config)
+    {
+        if(encoder->flags[EncodingFlags::H264_ONLY])
+            return TRUE;
+
+        char key[CACHE_MAX_LINE / 2] = {0};
+        char value[16] = {0};
+        return fallback_key(encoder, display, config, key, sizeof(key)) &&
+               util::cache_get(ENCODER_CONFIG->cache_path, key, value, sizeof(value)) &&
+               !strcmp(value, "1");
+    }
+
+    void
+    set_h264_only(Encoder* encoder,
+                  platf::Display* display,
+                  Config* config)
+    {
+        // encoder flags are part of the probe fingerprint, the decision only live in the cache
+        char key[CACHE_MAX_LINE / 2] = {0};
+        char value[] = "1";
+        if(fallback_key(encoder, display, config, key, sizeof(key)))
+            util::cache_set(ENCODER_CONFIG->cache_path, key, value);
+    }
+} // namespace encoder
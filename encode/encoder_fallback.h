@@ -0,0 +1,41 @@
+/**
+ * @file encoder_fallback.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __ENCODER_FALLBACK_H__
+#define __ENCODER_FALLBACK_H__
+
+#include <sunshine_util.h>
+#include <encoder_datatype.h>
+#include <encoder_device.h>
+#include <encoder_cost.h>
+#include <platform_common.h>
+
+namespace encoder
+{
+    /**
+     * @brief
+     * HEVC is known to be too heavy for this encoder, adapter and stream size,
+     * either from the H264_ONLY flag or from a decision of a previous session
+     */
+    bool                h264_only               (Encoder* encoder,
+                                                 platf::Display* display,
+                                                 Config* config);
+
+    /**
+     * @brief
+     * persist the decision in the encoder cache,
+     * every later session at this stream size then open H.264
+     */
+    void                set_h264_only           (Encoder* encoder,
+                                                 platf::Display* display,
+                                                 Config* config);
+} // namespace encoder
+
+#endif
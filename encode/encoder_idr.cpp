@@ -0,0 +1,122 @@
+/**
+ * @file encoder_idr.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-08-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <encoder_idr.h>
+#include <sunshine_util.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string.h>
+
+namespace encoder
+{
+    struct _IdrRequest {
+        std::atomic<bool> pending;
+
+        /**
+         * @brief 
+         * steady clock time in ns of the last keyframe, 0 if none
+         */
+        std::atomic<int64> last_issued;
+        int64 window;
+
+        std::atomic<uint64> requested;
+        std::atomic<uint64> coalesced;
+        std::atomic<uint64> issued;
+    };
+
+    static int64
+    now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    IdrRequest*
+    make_idr_request(int window_ms)
+    {
+        IdrRequest* request = (IdrRequest*)malloc(sizeof(IdrRequest));
+        memset((pointer)request,0,sizeof(IdrRequest));
+        new (&request->pending) std::atomic<bool>(FALSE);
+        new (&request->last_issued) std::atomic<int64>(0);
+        new (&request->requested) std::atomic<uint64>(0);
+        new (&request->coalesced) std::atomic<uint64>(0);
+        new (&request->issued) std::atomic<uint64>(0);
+
+        request->window = (int64)MAX(window_ms, 0) * 1000000;
+        return request;
+    }
+
+    void
+    request_idr(IdrRequest* request)
+    {
+        request->requested++;
+
+        // several receivers asking for the same frame get one keyframe,
+        // a request that arrive right after a keyframe wait for the window to expire
+        if(request->pending.exchange(TRUE))
+            request->coalesced++;
+    }
+
+    /**
+     * @brief 
+     * a keyframe that just left may already resynchronize the receiver,
+     * the next one is held back until window passed
+     */
+    static bool
+    idr_due(IdrRequest* request)
+    {
+        if(!request || !request->pending.load())
+            return FALSE;
+
+        int64 last = request->last_issued.load();
+        return !last || now_ns() - last >= request->window;
+    }
+
+    bool
+    take_idr(IdrRequest* request)
+    {
+        if(!idr_due(request) || !request->pending.exchange(FALSE))
+            return FALSE;
+
+        request->last_issued.store(now_ns());
+        request->issued++;
+        return TRUE;
+    }
+
+    bool
+    idr_pending(IdrRequest* request)
+    {
+        return idr_due(request);
+    }
+
+    void
+    idr_keyframe_sent(IdrRequest* request)
+    {
+        if(request)
+            request->last_issued.store(now_ns());
+    }
+
+    void
+    idr_stats(IdrRequest* request,
+              IdrStats* stats)
+    {
+        stats->requested = request->requested.load();
+        stats->coalesced = request->coalesced.load();
+        stats->issued    = request->issued.load();
+    }
+
+    void
+    idr_request_finalize(IdrRequest* request)
+    {
+        free(request);
+    }
+} // namespace encoder
@@ -0,0 +1,72 @@
+/**
+ * @file encoder_idr.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-08-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __ENCODER_IDR_H__
+#define __ENCODER_IDR_H__
+
+#include <sunshine_util.h>
+
+namespace encoder
+{
+    typedef struct _IdrRequest IdrRequest;
+
+    typedef struct _IdrStats {
+        /**
+         * @brief 
+         * requested = coalesced + accepted,
+         * issued is the number of frame actually marked as keyframe
+         */
+        uint64 requested;
+        uint64 coalesced;
+        uint64 issued;
+    }IdrStats;
+
+    /**
+     * @brief 
+     * keyframe request shared between the network side and one capture stream,
+     * a request within window_ms of the last keyframe is held until the window expire,
+     * every request made meanwhile share that keyframe
+     */
+    IdrRequest*         make_idr_request        (int window_ms);
+
+    /**
+     * @brief 
+     * thread safe, mark the next encoded frame as a keyframe
+     */
+    void                request_idr             (IdrRequest* request);
+
+    /**
+     * @brief 
+     * called by the encoder before each frame, 
+     * return TRUE when the frame must be a keyframe
+     */
+    bool                take_idr                (IdrRequest* request);
+
+    /**
+     * @brief 
+     * same as take_idr without consuming the request,
+     * a request still held by the window is not pending yet
+     */
+    bool                idr_pending             (IdrRequest* request);
+
+    /**
+     * @brief 
+     * called for every keyframe leaving the encoder, 
+     * forced or not, the window count from the last one
+     */
+    void                idr_keyframe_sent       (IdrRequest* request);
+
+    void                idr_stats               (IdrRequest* request,
+                                                 IdrStats* stats);
+
+    void                idr_request_finalize    (IdrRequest* request);
+} // namespace encoder
+
+#endif
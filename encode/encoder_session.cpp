@@ -17,11 +17,14 @@
 
 #include <sunshine_config.h>
 #include <encoder_thread.h>
+#include <encoder_stripe.h>
+#include <encoder_tune.h>
 
 extern "C" {
 #include <libswscale/swscale.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/opt.h>
 }
 
 namespace encoder
@@ -35,54 +38,179 @@ namespace encoder
      * @param format 
      * @return int 
      */
-    int 
-    hwframe_ctx(libav::CodecContext* ctx, 
-                libav::BufferRef* device, 
-                libav::PixelFormat format) 
+    libav::BufferRef*
+    make_hwframes(libav::BufferRef* device, 
+                  libav::PixelFormat hw_format,
+                  libav::PixelFormat sw_format,
+                  int width, int height) 
     {
         libav::BufferRef* frame_ref = av_hwframe_ctx_alloc(device);
+        if(!frame_ref)
+            return NULL;
 
         AVHWFramesContext* frame_ctx = (AVHWFramesContext *)frame_ref->data;
-        frame_ctx->format            = ctx->pix_fmt;
-        frame_ctx->sw_format         = format;
-        frame_ctx->height            = ctx->height;
-        frame_ctx->width             = ctx->width;
+        frame_ctx->format            = hw_format;
+        frame_ctx->sw_format         = sw_format;
+        frame_ctx->height            = height;
+        frame_ctx->width             = width;
         frame_ctx->initial_pool_size = 0;
 
-        int err = av_hwframe_ctx_init(frame_ref);
-        if( err < 0) 
-            return err;
+        if(av_hwframe_ctx_init(frame_ref) < 0) {
+            av_buffer_unref(&frame_ref);
+            return NULL;
+        }
+        return frame_ref;
+    }
+
+    /**
+     * @brief 
+     * 
+     * @param ctx 
+     * @param hwdevice_ctx 
+     * @param format 
+     * @return int 
+     */
+    int 
+    hwframe_ctx(libav::CodecContext* ctx, 
+                libav::BufferRef* device, 
+                libav::PixelFormat format) 
+    {
+        libav::BufferRef* frame_ref = make_hwframes(device, ctx->pix_fmt, format, ctx->width, ctx->height);
+        if(!frame_ref) 
+            return -1;
         
-        ctx->hw_frames_ctx = av_buffer_ref(frame_ref);
+        ctx->hw_frames_ctx = frame_ref;
         return 0;
     }
 
     void
-    handle_options(AVDictionary* options, 
+    handle_options(AVDictionary** options, 
                    util::KeyValue* keyvalue)
     {
         util::KeyValue* option = keyvalue;
         while(option->type) {
             if(option->type == util::Type::STRING)
-                av_dict_set(&options,option->key,option->string_value,0);
+                av_dict_set(options,option->key,option->string_value,0);
 
             if(option->type == util::Type::INT)
-                av_dict_set_int(&options,option->key,option->int_value,0);
+                av_dict_set_int(options,option->key,option->int_value,0);
 
             option++;
         }
     }
 
 
+    /**
+     * @brief 
+     * every option of keyvalue is known by the codec
+     */
+    bool
+    has_options(libav::CodecContext* ctx,
+                util::KeyValue* keyvalue)
+    {
+        if(!keyvalue || !keyvalue->type)
+            return FALSE;
+
+        for(util::KeyValue* option = keyvalue; option->type; option++) {
+            if(!av_opt_find(ctx, option->key, NULL, 0, AV_OPT_SEARCH_CHILDREN))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    /**
+     * @brief 
+     * format the software codec take for the downloaded sw_fmt capture,
+     * x265 has no semi-planar input, nv12 and p010 are then given to it planar
+     */
+    static libav::PixelFormat
+    codec_pix_fmt(libav::Codec* codec,
+                  libav::PixelFormat sw_fmt)
+    {
+        if(!codec->pix_fmts)
+            return sw_fmt;
+
+        for(const libav::PixelFormat* fmt = codec->pix_fmts; *fmt != AV_PIX_FMT_NONE; fmt++) {
+            if(*fmt == sw_fmt)
+                return sw_fmt;
+        }
+
+        return sw_fmt == AV_PIX_FMT_P010 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P;
+    }
+
+    static libav::Frame*
+    make_sw_frame(libav::PixelFormat format,
+                  int width,
+                  int height)
+    {
+        libav::Frame* frame = av_frame_alloc();
+        frame->format = format;
+        frame->width  = width;
+        frame->height = height;
+        if(av_frame_get_buffer(frame, 0) < 0) {
+            LOG_ERROR("Could not allocate software frame");
+            av_frame_free(&frame);
+            return NULL;
+        }
+        return frame;
+    }
+
     void
     free_encode_context(pointer data)
     {
         EncodeContext* ctx = (EncodeContext*)data;
         avcodec_free_context(&ctx->context);
-        ctx->device->klass->finalize(ctx->device);
+        if(ctx->device)
+            ctx->device->klass->finalize(ctx->device);
+
+        // blocks still referenced by queued packets are freed on release
+        if(ctx->pool)
+            BUFFER_POOL_CLASS->finalize(ctx->pool);
         free(data);
     }
 
+#if LIBAV_HAS_ENCODE_BUFFER
+    void
+    pool_buffer_free(void* opaque, 
+                     uint8_t* data)
+    {
+        BUFFER_POOL_CLASS->release(opaque);
+    }
+
+    /**
+     * @brief 
+     * let the encoder write its bitstream into a pooled block,
+     * rtp datagrams are later gathered from this block
+     * 
+     * @param ctx 
+     * @param pkt 
+     * @param flags 
+     * @return int 
+     */
+    int
+    session_get_encode_buffer(libav::CodecContext* ctx, 
+                              libav::Packet* pkt, 
+                              int flags)
+    {
+        util::BufferPool* pool = (util::BufferPool*)ctx->opaque;
+        uint size = pkt->size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+        byte* payload = (byte*)BUFFER_POOL_CLASS->acquire(pool,size);
+        if(!payload)
+            return AVERROR(ENOMEM);
+
+        pkt->buf = av_buffer_create(payload, size, pool_buffer_free, payload, 0);
+        if(!pkt->buf) {
+            BUFFER_POOL_CLASS->release(payload);
+            return AVERROR(ENOMEM);
+        }
+
+        memset(payload + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        pkt->data = pkt->buf->data;
+        return 0;
+    }
+#endif
+
     EncodeContext*
     make_encode_context(platf::Device* device,
                         char* encoder)
@@ -102,11 +230,60 @@ namespace encoder
             LOG_ERROR("Couldn't create context");
             return NULL;
         }
+
+#if LIBAV_HAS_ENCODE_BUFFER
+        if(ctx->codec->capabilities & AV_CODEC_CAP_DR1) {
+            ctx->pool = BUFFER_POOL_CLASS->init(ENCODE_POOL_BLOCK_SIZE,
+                                                ENCODE_POOL_MAX_FREE);
+            ctx->context->opaque            = ctx->pool;
+            ctx->context->get_encode_buffer = session_get_encode_buffer;
+        }
+#endif
         
         return ctx;
     }
 
 
+    /**
+     * @brief 
+     * bitrate in kbps, scaled by open_framerate / framerate 
+     * so that a codec fed less frames than it was opened for keep the target rate
+     */
+    void
+    set_bitrate(libav::CodecContext* ctx,
+                int bitrate,
+                bool hardware,
+                int open_framerate,
+                int framerate)
+    {
+        int64 rate = (int64)bitrate * (hardware ? 1000 : 800); // software bitrate overshoots by ~20%
+        rate = rate * open_framerate / framerate;
+
+        ctx->rc_max_rate    = rate;
+        ctx->rc_buffer_size = rate / 10;
+        ctx->bit_rate       = rate;
+        ctx->rc_min_rate    = rate;
+    }
+
+    /**
+     * @brief 
+     * number of independent codec instances the picture is split between, 1 unless 
+     * the experimental stream_slices is on. their bitstreams are never reassembled
+     * into one access unit, the receiver get one rtp stream per stripe (see RTP_MAX_STREAMS)
+     */
+    static int
+    streamed_stripes(Encoder* encoder,
+                     Config* config,
+                     bool hardware)
+    {
+        if(hardware || 
+           !ENCODER_CONFIG->sw.stream_slices || 
+           !encoder->flags[EncodingFlags::PARALLEL_ENCODING])
+            return 1;
+
+        return MIN(MAX(ENCODER_CONFIG->sw.stripes, config->slicesPerFrame), STRIPE_MAX);
+    }
+
     Session*
     make_session(Encoder* encoder, 
                  Config* config, 
@@ -130,7 +307,8 @@ namespace encoder
         libav::CodecContext* ctx = encode_ctx->context;
         ctx->width     = config->width;
         ctx->height    = config->height;
-        ctx->time_base = AVRational { 1, config->framerate };
+        // framerate only size rate control, timing come from capture timestamps
+        ctx->time_base = AVRational { 1, PTS_CLOCK_RATE };
         ctx->framerate = AVRational { config->framerate, 1 };
 
         if(config->videoFormat == 0) {
@@ -154,6 +332,17 @@ namespace encoder
 
         ctx->keyint_min = ENCODER_CONFIG->gop_size - 5;
 
+        // rolling intra refresh spread the cost of a keyframe over the period,
+        // encoders refresh the whole picture once every gop_size frames
+        bool intra_refresh = ENCODER_CONFIG->intra_refresh_period > 0 && 
+                             has_options(ctx, video_format->intra_refresh);
+        if(intra_refresh) {
+            ctx->gop_size   = ENCODER_CONFIG->intra_refresh_period;
+            ctx->keyint_min = ENCODER_CONFIG->intra_refresh_period;
+        } else if(ENCODER_CONFIG->intra_refresh_period > 0) {
+            LOG_WARNING("intra refresh not supported by encoder, using IDR");
+        }
+
         if(config->numRefFrames == 0) {
             ctx->refs = video_format->capabilities[FrameFlags::REF_FRAMES_AUTOSELECT] ? 0 : 16;
         }
@@ -206,10 +395,16 @@ namespace encoder
             sw_fmt = encoder->dynamic_pix_fmt;
         }
 
+        // software codec may not take the semi-planar format the gpu converter output
+        libav::PixelFormat codec_fmt = hardware ? sw_fmt : codec_pix_fmt(encode_ctx->codec, sw_fmt);
+
         // Used by cbs::make_sps_hevc
-        ctx->sw_pix_fmt = sw_fmt;
+        ctx->sw_pix_fmt = codec_fmt;
+
+        int instances = streamed_stripes(encoder, config, hardware);
 
         libav::BufferRef* hwdevice_ctx;
+        libav::BufferRef* capture_frames = NULL;
         if(hardware) {
             ctx->pix_fmt = encoder->dev_pix_fmt;
 
@@ -223,13 +418,28 @@ namespace encoder
             
             ctx->slices = config->slicesPerFrame;
         } else /* software */ {
-            // TODO software 
-            // ctx->pix_fmt = sw_fmt;
+            ctx->pix_fmt = codec_fmt;
+
+            // Clients will request for the fewest slices per frame to get the
+            // most efficient encode, but we may want to provide more slices than
+            // requested to ensure we have enough parallelism for good performance.
+            int threads = tune_threads(video_format, config, instances);
+            ctx->slices = MAX(config->slicesPerFrame, threads);
+
+            // stripes are slices of the one picture, encoded by the slice threads of a single codec
+            if(instances == 1)
+                ctx->slices = MAX(ctx->slices, ENCODER_CONFIG->sw.stripes);
+
+            // capture is still converted on the gpu, 
+            // the codec get a copy downloaded from these frames
+            hwdevice_ctx = encoder->make_hw_ctx_func(device);
+            if(!hwdevice_ctx)
+                return NULL;
 
-            // // Clients will request for the fewest slices per frame to get the
-            // // most efficient encode, but we may want to provide more slices than
-            // // requested to ensure we have enough parallelism for good performance.
-            // ctx->slices = MAX(config->slicesPerFrame, ENCODER_CONFIG->min_threads);
+            capture_frames = make_hwframes(hwdevice_ctx, encoder->dev_pix_fmt, sw_fmt, ctx->width, ctx->height);
+            av_buffer_unref(&hwdevice_ctx);
+            if(!capture_frames)
+                return NULL;
         }
 
         if(!video_format->capabilities[FrameFlags::SLICE]) {
@@ -244,23 +454,30 @@ namespace encoder
          * map from config to option here
          */
         AVDictionary *options = NULL;
-        handle_options(options,video_format->options);
+        handle_options(&options,video_format->options);
+        if(intra_refresh)
+            handle_options(&options,video_format->intra_refresh);
         if(video_format->capabilities[FrameFlags::CBR]) {
-            auto bitrate        = config->bitrate * (hardware ? 1000 : 800); // software bitrate overshoots by ~20%
-            ctx->rc_max_rate    = bitrate;
-            ctx->rc_buffer_size = bitrate / 10;
-            ctx->bit_rate       = bitrate;
-            ctx->rc_min_rate    = bitrate;
+            set_bitrate(ctx, config->bitrate, hardware, 1, 1);
         }
         else if(video_format->qp) {
-            handle_options(options,video_format->qp);
+            handle_options(&options,video_format->qp);
         }
         else {
             LOG_ERROR("Couldn't set video quality");
             return NULL;
         }
 
-        if(int status = avcodec_open2(ctx, encode_ctx->codec, &options)) {
+        int status = 0;
+        StripeGroup* stripes = NULL;
+        if(instances == 1) 
+            status = avcodec_open2(ctx, encode_ctx->codec, &options);
+        else 
+            // ctx stay unopened, it is only the template of every stripe
+            stripes = make_stripe_group(encode_ctx, options, instances);
+        av_dict_free(&options);
+
+        if(status || (instances > 1 && !stripes)) {
             char err_str[AV_ERROR_MAX_STRING_SIZE] { 0 };
             LOG_ERROR("Could not open codec");
             LOG_ERROR(av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status));
@@ -268,13 +485,38 @@ namespace encoder
         }
 
         libav::Frame* frame = av_frame_alloc();
-        frame->format = ctx->pix_fmt;
+        frame->format = hardware ? ctx->pix_fmt : encoder->dev_pix_fmt;
         frame->width  = ctx->width;
         frame->height = ctx->height;
 
 
         if(hardware) 
             frame->hw_frames_ctx = av_buffer_ref(ctx->hw_frames_ctx);
+        else 
+            frame->hw_frames_ctx = capture_frames;
+
+        libav::Frame* sw_frame = NULL;
+        libav::Frame* codec_frame = NULL;
+        libav::ScaleContext* sws = NULL;
+        if(!hardware) {
+            sw_frame = make_sw_frame(sw_fmt, ctx->width, ctx->height);
+            if(!sw_frame)
+                return NULL;
+        }
+
+        if(!hardware && codec_fmt != sw_fmt) {
+            codec_frame = make_sw_frame(codec_fmt, ctx->width, ctx->height);
+            sws = sws_getContext(ctx->width, ctx->height, sw_fmt,
+                                 ctx->width, ctx->height, codec_fmt,
+                                 SWS_POINT, NULL, NULL, NULL);
+            if(!codec_frame || !sws) {
+                LOG_ERROR("Could not convert software frame to the codec format");
+                av_frame_free(&sw_frame);
+                av_frame_free(&codec_frame);
+                sws_freeContext(sws);
+                return NULL;
+            }
+        }
         
 
         if(!device->data) {
@@ -302,13 +544,67 @@ namespace encoder
         memset(session,0,sizeof(Session));
         session->pts = frame->pts;
         session->encode = encode_ctx;
+        session->encoder = encoder;
+        session->config = *config;
+        session->open_framerate = config->framerate;
+        session->hardware = hardware;
+        session->sw_frame = sw_frame;
+        session->codec_frame = codec_frame;
+        session->sws = sws;
+        session->stripes = stripes;
         return session;
     }
 
+    int
+    reconfigure(Session* session,
+                int bitrate,
+                int framerate)
+    {
+        Config* current = &session->config;
+        if(bitrate == current->bitrate && framerate == current->framerate)
+            return 0;
+
+        if(bitrate <= 0 || framerate <= 0)
+            return 1;
+
+        // rate control was sized for open_framerate, 
+        // fewer frames are compensated through the bitrate, more need a new codec
+        if(framerate > session->open_framerate)
+            return 1;
+
+        CodecConfig* video_format = (current->videoFormat == 0) ? &session->encoder->h264 : &session->encoder->hevc;
+        if(video_format->capabilities[FrameFlags::CBR]) {
+            if(!session->encoder->flags[EncodingFlags::DYNAMIC_BITRATE] || video_format->fixed_rate)
+                return 1;
+
+            // every stripe own a codec opened from the template context
+            if(session->stripes)
+                return 1;
+
+            // picked up by the encoder on the next avcodec_send_frame
+            set_bitrate(session->encode->context, 
+                        bitrate, 
+                        session->hardware, 
+                        session->open_framerate, 
+                        framerate);
+        }
+
+        current->bitrate   = bitrate;
+        current->framerate = framerate;
+        return 0;
+    }
+
     void
     session_finalize(pointer session)
     {
         Session* self = (Session*) session;
+        if(self->stripes)
+            stripe_group_finalize(self->stripes);
+        if(self->sw_frame)
+            av_frame_free(&self->sw_frame);
+        if(self->codec_frame)
+            av_frame_free(&self->codec_frame);
+        sws_freeContext(self->sws);
         free_encode_context(self->encode);
         free(session);
     }
@@ -344,7 +640,6 @@ namespace encoder
         if(!ses)
             return NULL;
 
-        rtp::make_rtp_context(ses->encode);
         return BUFFER_CLASS->init((pointer)ses,sizeof(Session),session_finalize);
     }
 } // namespace encoder
@@ -21,6 +21,15 @@ namespace encoder
 
 
 
+    /**
+     * @brief 
+     * device may be NULL for codec instance that does not own the capture device
+     */
+    EncodeContext*      make_encode_context(platf::Device* device,
+                                            char* encoder);
+
+    void                free_encode_context(pointer data);
+
     Session*            make_session    (Encoder* encoder, 
                                          Config* config, 
                                          int width, int height, 
@@ -29,6 +38,16 @@ namespace encoder
     
     void                session_finalize(pointer session);
 
+    /**
+     * @brief 
+     * apply bitrate (kbps) and framerate on the open codec, without a new IDR
+     * 
+     * @return int 0 when applied in place, 1 when session must be recreated
+     */
+    int                 reconfigure     (Session* session,
+                                         int bitrate,
+                                         int framerate);
+
  
     util::Buffer*
     make_session_buffer(platf::Image* img, 
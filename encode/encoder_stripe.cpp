@@ -0,0 +1,337 @@
+/**
+ * @file encoder_stripe.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <encoder_stripe.h>
+#include <encoder_session.h>
+#include <encoder_thread.h>
+
+#include <sunshine_util.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <string.h>
+
+// stripe height is kept on macroblock / CTU boundary
+#define STRIPE_ALIGN 16
+
+namespace encoder
+{
+    typedef struct _Stripe {
+        EncodeContext* encode;
+
+        /**
+         * @brief 
+         * view on the shared frame, no pixel is copied
+         */
+        libav::Frame* view;
+
+        int y;
+        int height;
+
+        util::QueueArray* packets;
+        bool ok;
+
+        /**
+         * @brief 
+         * set under the group lock once the stripe of the current frame is encoded,
+         * packets is then owned by the capture thread until the next frame
+         */
+        bool finished;
+
+        std::thread thread;
+    }Stripe;
+
+    struct _StripeGroup {
+        Stripe stripes[STRIPE_MAX];
+        int count;
+
+        std::mutex lock;
+        std::condition_variable start;
+        std::condition_variable done;
+
+        /**
+         * @brief 
+         * bumped for every frame, workers wake up when it change
+         */
+        uint64 generation;
+        bool closed;
+
+        libav::Frame* frame;
+    };
+
+
+    /**
+     * @brief 
+     * copy everything make_session configured on the template
+     */
+    static void
+    stripe_context(libav::CodecContext* ctx,
+                   libav::CodecContext* tmpl,
+                   int height)
+    {
+        ctx->width           = tmpl->width;
+        ctx->height          = height;
+        ctx->time_base       = tmpl->time_base;
+        ctx->framerate       = tmpl->framerate;
+        ctx->profile         = tmpl->profile;
+        ctx->max_b_frames    = tmpl->max_b_frames;
+        ctx->gop_size        = tmpl->gop_size;
+        ctx->keyint_min      = tmpl->keyint_min;
+        ctx->refs            = tmpl->refs;
+        ctx->flags           = tmpl->flags;
+        ctx->flags2          = tmpl->flags2;
+        ctx->color_range     = tmpl->color_range;
+        ctx->color_primaries = tmpl->color_primaries;
+        ctx->color_trc       = tmpl->color_trc;
+        ctx->colorspace      = tmpl->colorspace;
+        ctx->pix_fmt         = tmpl->pix_fmt;
+        ctx->sw_pix_fmt      = tmpl->sw_pix_fmt;
+        ctx->slices          = tmpl->slices;
+        ctx->thread_type     = tmpl->thread_type;
+        ctx->thread_count    = tmpl->thread_count;
+
+        // rate is shared by stripe area
+        ctx->bit_rate        = tmpl->bit_rate       * height / tmpl->height;
+        ctx->rc_max_rate     = tmpl->rc_max_rate    * height / tmpl->height;
+        ctx->rc_min_rate     = tmpl->rc_min_rate    * height / tmpl->height;
+        ctx->rc_buffer_size  = tmpl->rc_buffer_size * height / tmpl->height;
+    }
+
+
+    static bool
+    stripe_encode(Stripe* stripe,
+                  int index,
+                  libav::Frame* frame)
+    {
+        libav::CodecContext* ctx = stripe->encode->context;
+        libav::Frame* view = stripe->view;
+
+        av_frame_unref(view);
+        if(av_frame_ref(view, frame) < 0)
+            return FALSE;
+
+        // every 4:2:0 format carry half height chroma, interleaved (nv12, p010) or planar
+        view->data[0] += stripe->y * view->linesize[0];
+        view->data[1] += (stripe->y / 2) * view->linesize[1];
+        if(view->data[2])
+            view->data[2] += (stripe->y / 2) * view->linesize[2];
+        view->height   = stripe->height;
+
+        int ret = avcodec_send_frame(ctx, view);
+        av_frame_unref(view);
+        if(ret < 0) {
+            char err_str[AV_ERROR_MAX_STRING_SIZE] { 0 };
+            LOG_ERROR(av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret));
+            return FALSE;
+        }
+
+        while(TRUE) {
+            libav::Packet* packet = av_packet_alloc();
+            ret = avcodec_receive_packet(ctx, packet);
+            if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                av_packet_free(&packet);
+                return TRUE;
+            } else if(ret < 0) {
+                av_packet_free(&packet);
+                return FALSE;
+            }
+
+            packet->stream_index = index;
+            util::Buffer* pkt = BUFFER_CLASS->init(packet,sizeof(libav::Packet),free_av_packet);
+            QUEUE_ARRAY_CLASS->push(stripe->packets,pkt);
+            BUFFER_CLASS->unref(pkt);
+        }
+    }
+
+    static void
+    stripe_worker(StripeGroup* group,
+                  int index)
+    {
+        Stripe* stripe = &group->stripes[index];
+        uint64 seen = 0;
+
+        while(TRUE) {
+            libav::Frame* frame;
+            {
+                std::unique_lock<std::mutex> lock(group->lock);
+                group->start.wait(lock, [&] { return group->closed || group->generation != seen; });
+                if(group->closed)
+                    return;
+
+                seen  = group->generation;
+                frame = group->frame;
+            }
+
+            stripe->ok = stripe_encode(stripe, index, frame);
+
+            {
+                std::lock_guard<std::mutex> lock(group->lock);
+                stripe->finished = TRUE;
+            }
+            group->done.notify_one();
+        }
+    }
+
+
+    StripeGroup*
+    make_stripe_group(EncodeContext* tmpl,
+                      AVDictionary* options,
+                      int count)
+    {
+        libav::CodecContext* base = tmpl->context;
+
+        // every stripe need at least one row of macroblock
+        count = MIN(count, STRIPE_MAX);
+        count = MIN(count, base->height / STRIPE_ALIGN);
+        if(count < 1)
+            count = 1;
+
+        int stripe_height = FFALIGN((base->height + count - 1) / count, STRIPE_ALIGN);
+        count = (base->height + stripe_height - 1) / stripe_height;
+
+        StripeGroup* group = (StripeGroup*)malloc(sizeof(StripeGroup));
+        memset((pointer)group,0,sizeof(StripeGroup));
+        new (&group->lock) std::mutex();
+        new (&group->start) std::condition_variable();
+        new (&group->done) std::condition_variable();
+
+        for(int i = 0; i < count; i++) {
+            Stripe* stripe  = &group->stripes[i];
+            stripe->y       = i * stripe_height;
+            stripe->height  = MIN(stripe_height, base->height - stripe->y);
+
+            stripe->encode = make_encode_context(NULL, (char*)tmpl->codec->name);
+            if(!stripe->encode) 
+                goto fail;
+            group->count++;
+
+            stripe_context(stripe->encode->context, base, stripe->height);
+
+            AVDictionary* stripe_options = NULL;
+            av_dict_copy(&stripe_options, options, 0);
+            int status = avcodec_open2(stripe->encode->context, stripe->encode->codec, &stripe_options);
+            av_dict_free(&stripe_options);
+            if(status) {
+                char err_str[AV_ERROR_MAX_STRING_SIZE] { 0 };
+                LOG_ERROR("Could not open stripe codec");
+                LOG_ERROR(av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status));
+                goto fail;
+            }
+
+            stripe->view    = av_frame_alloc();
+            stripe->packets = QUEUE_ARRAY_CLASS->init();
+        }
+
+        for(int i = 0; i < group->count; i++) 
+            new (&group->stripes[i].thread) std::thread(stripe_worker, group, i);
+        return group;
+
+        fail:
+        stripe_group_finalize(group);
+        return NULL;
+    }
+
+    bool
+    stripe_group_encode(StripeGroup* group,
+                        libav::Frame* frame,
+                        util::QueueArray* packets,
+                        PacketSink sink,
+                        pointer data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(group->lock);
+            group->frame = frame;
+            for(int i = 0; i < group->count; i++) 
+                group->stripes[i].finished = FALSE;
+            group->generation++;
+        }
+        group->start.notify_all();
+
+        // a stripe is sent as soon as it and every stripe above it are encoded,
+        // the top of the picture is on the wire while the bottom is still encoding.
+        // order is kept so that stream 0 always carry the first packet of a frame
+        bool ret = TRUE;
+        for(int i = 0; i < group->count; i++) {
+            Stripe* stripe = &group->stripes[i];
+            {
+                std::unique_lock<std::mutex> lock(group->lock);
+                group->done.wait(lock, [&] { return stripe->finished; });
+            }
+            ret = ret && stripe->ok;
+
+            while(QUEUE_ARRAY_CLASS->peek(stripe->packets)) {
+                int size;
+                util::Buffer* pkt;
+                QUEUE_ARRAY_CLASS->pop(stripe->packets,&pkt,&size);
+                if(ret)
+                    QUEUE_ARRAY_CLASS->push(packets,pkt);
+                BUFFER_CLASS->unref(pkt);
+            }
+
+            if(ret && sink)
+                sink(packets, data);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(group->lock);
+            group->frame = NULL;
+        }
+        return ret;
+    }
+
+    int
+    stripe_group_count(StripeGroup* group)
+    {
+        return group->count;
+    }
+
+    EncodeContext*
+    stripe_group_context(StripeGroup* group,
+                         int index)
+    {
+        return group->stripes[index].encode;
+    }
+
+    void
+    stripe_group_finalize(StripeGroup* group)
+    {
+        {
+            std::lock_guard<std::mutex> lock(group->lock);
+            group->closed = TRUE;
+        }
+        group->start.notify_all();
+
+        for(int i = 0; i < group->count; i++) {
+            Stripe* stripe = &group->stripes[i];
+            if(stripe->thread.joinable())
+                stripe->thread.join();
+            stripe->thread.~thread();
+
+            if(stripe->view)
+                av_frame_free(&stripe->view);
+            if(stripe->packets)
+                QUEUE_ARRAY_CLASS->stop(stripe->packets);
+            if(stripe->encode)
+                free_encode_context(stripe->encode);
+        }
+
+        group->lock.~mutex();
+        group->start.~condition_variable();
+        group->done.~condition_variable();
+        free(group);
+    }
+} // namespace encoder
@@ -0,0 +1,65 @@
+/**
+ * @file encoder_stripe.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __ENCODER_STRIPE_H__
+#define __ENCODER_STRIPE_H__
+
+#include <sunshine_util.h>
+#include <encoder_datatype.h>
+
+#define STRIPE_MAX 16
+
+namespace encoder
+{
+    /**
+     * @brief 
+     * frame is split into horizontal stripes, 
+     * each stripe is encoded by its own codec instance on its own thread.
+     * 
+     * |---------- stripe 0 ----------|   packet stream_index 0
+     * |---------- stripe 1 ----------|   packet stream_index 1
+     * |            ...               |
+     * 
+     * every stripe is an independent bitstream (a tile of the picture),
+     * packets of one frame are pushed in stripe order, 
+     * each stripe as soon as it and the ones above it are encoded.
+     * stripes run in parallel, so the first one leave at most a few stripe times early.
+     * used by the experimental stream_slices only, plain slices stay in one codec
+     * (see RTP_MAX_STREAMS for what the receiver get)
+     * 
+     * @param tmpl  configured but unopened codec context, used as template
+     * @param options codec options, copied for every stripe
+     * @param count number of stripe requested
+     */
+    StripeGroup*        make_stripe_group           (EncodeContext* tmpl,
+                                                     AVDictionary* options,
+                                                     int count);
+
+    /**
+     * @brief 
+     * packets of every stripe are moved to packets, sink is then called 
+     * once per stripe without waiting for the stripes below it.
+     * sink may be NULL, packets then hold the whole frame on return
+     */
+    bool                stripe_group_encode         (StripeGroup* group,
+                                                     libav::Frame* frame,
+                                                     util::QueueArray* packets,
+                                                     PacketSink sink,
+                                                     pointer data);
+
+    int                 stripe_group_count          (StripeGroup* group);
+
+    EncodeContext*      stripe_group_context        (StripeGroup* group,
+                                                     int index);
+
+    void                stripe_group_finalize       (StripeGroup* group);
+} // namespace encoder
+
+#endif
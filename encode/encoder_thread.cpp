@@ -13,6 +13,7 @@
 #include <sunshine_util.h>
 
 #include <encoder_d3d11_device.h>
+#include <encoder_software_device.h>
 #include <sunshine_config.h>
 #include <encoder_device.h>
 
@@ -27,28 +28,128 @@ extern "C" {
 }
 
 #include <encoder_session.h>
+#include <encoder_stripe.h>
+#include <encoder_idr.h>
+#include <encoder_watchdog.h>
+#include <encoder_fallback.h>
 #include <windows_helper.h>
+#include <sunshine_rtp.h>
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
 #include <thread>
 #include <string.h>
 
+// how often the watchdog read the worker heartbeat
+#define WATCHDOG_INTERVAL       50ms
+
+// more restarts than this within the window means the failure is not transient
+#define WATCHDOG_MAX_RESTARTS   3
+#define WATCHDOG_RESTART_WINDOW 10s
+
+// how long the session wait for abandoned workers before it free what they share
+#define WATCHDOG_STRAGGLER_WAIT 2000
+
 
 using namespace std::literals;
 
 namespace encoder {
-    struct _EncodeThreadContext {
-        int frame_nr;
+    /**
+     * @brief 
+     * simulcast stream, encoded from the same captured image
+     */
+    typedef struct _Rendition {
+        Config config;
+        util::Buffer* session;
+        rtp::RtpOutput* output;
+        util::QueueArray* packet_queue;
+        IdrRequest* keyframe;
+    }Rendition;
 
+    struct _EncodeThreadContext {
         util::Broadcaster* shutdown_event;
         util::Broadcaster* join_event;
+        rtp::RtpOutput* output;
         util::QueueArray* packet_queue;
 
         std::thread thread;
 
-        Config* config;
+        /**
+         * @brief 
+         * copy of the encoder config, a codec fallback only change this worker,
+         * bitrate and framerate follow the client through ENCODER_CONFIG->conf
+         */
+        Config config;
 
         encoder::Encoder* encoder;
         platf::Display* display;
+
+        /**
+         * @brief 
+         * image and encode session live across capture calls,
+         * they are only rebuilt when the display output change
+         */
+        platf::Image* img;
+        util::Buffer* session;
+
+        /**
+         * @brief 
+         * set by the network side when a receiver need a keyframe
+         */
+        IdrRequest* keyframe;
+
+        /**
+         * @brief 
+         * set when a config change could not be applied on the open codec
+         */
+        bool recreate;
+
+        Rendition simulcast[SIMULCAST_MAX];
+        int simulcast_count;
+
+        /**
+         * @brief 
+         * steady clock time in ns of the last encoded frame,
+         * idle counts the unchanged slots that were not encoded
+         */
+        int64 last_encode;
+        uint64 idle;
+
+        // stage the worker is in, read by the watchdog
+        Heartbeat* beat;
+
+        /**
+         * @brief 
+         * set by the watchdog when it gave up on a stuck worker,
+         * a worker that wake up afterward exit silently and free its own context
+         */
+        std::atomic<bool> abandoned;
+
+        /**
+         * @brief 
+         * held while the worker touch what it share with the session 
+         * (packet queues, keyframe requests, stream descriptions, shutdown event),
+         * abandoned is set under it so that nothing is published after the watchdog gave up
+         */
+        std::mutex publish;
+
+        // packets being encoded, moved to the shared queue by worker_publish
+        util::QueueArray* staging;
+
+        // abandoned workers of the same watchdog
+        Stragglers* stragglers;
+
+        // HEVC encode time of the main stream
+        CostMonitor cost;
+
+        /**
+         * @brief 
+         * capture time in ns of the first encoded picture, pts count from it
+         */
+        int64 epoch;
+        int64 last_pts;
     };
 
     void
@@ -57,27 +158,133 @@ namespace encoder {
         av_free_packet((libav::Packet*)pkt);
     }
 
+    /**
+     * @brief 
+     * destination of the packets of one stream, handed to encode as sink data
+     */
+    typedef struct _Publication {
+        EncodeThreadContext* thread_ctx;
+        util::QueueArray* queue;
+        IdrRequest* keyframe;
+    }Publication;
+
+    /**
+     * @brief 
+     * PacketSink, move the staged packets to the shared queue, 
+     * they are dropped if the watchdog abandoned the worker in the mean time.
+     * keyframes the encoder placed on its own restart the idr window of keyframe
+     */
+    static void
+    worker_publish(util::QueueArray* staging,
+                   pointer data)
+    {
+        Publication* publication = (Publication*)data;
+        EncodeThreadContext* thread_ctx = publication->thread_ctx;
+        util::QueueArray* queue = publication->queue;
+        IdrRequest* keyframe = publication->keyframe;
+
+        std::lock_guard<std::mutex> guard(thread_ctx->publish);
+        bool abandoned = thread_ctx->abandoned.load();
+        while(QUEUE_ARRAY_CLASS->peek(staging)) {
+            util::Buffer* pkt = NULL;
+            QUEUE_ARRAY_CLASS->pop(staging, &pkt, NULL);
+            if(!abandoned) {
+                libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(pkt, NULL);
+                if(packet->flags & AV_PKT_FLAG_KEY)
+                    idr_keyframe_sent(keyframe);
+                BUFFER_CLASS->unref(pkt);
+                QUEUE_ARRAY_CLASS->push(queue, pkt);
+            }
+            BUFFER_CLASS->unref(pkt);
+        }
+    }
+
+    // a request taken by an abandoned worker would be lost for its replacement
+    static bool
+    worker_take_idr(EncodeThreadContext* thread_ctx,
+                    IdrRequest* keyframe)
+    {
+        std::lock_guard<std::mutex> guard(thread_ctx->publish);
+        return !thread_ctx->abandoned.load() && take_idr(keyframe);
+    }
+
+    static bool
+    worker_idr_pending(EncodeThreadContext* thread_ctx,
+                       IdrRequest* keyframe)
+    {
+        std::lock_guard<std::mutex> guard(thread_ctx->publish);
+        return !thread_ctx->abandoned.load() && idr_pending(keyframe);
+    }
+
+    static void
+    worker_publish_bitrate(EncodeThreadContext* thread_ctx,
+                           rtp::RtpOutput* output,
+                           int bitrate)
+    {
+        std::lock_guard<std::mutex> guard(thread_ctx->publish);
+        if(!thread_ctx->abandoned.load())
+            rtp::set_output_bitrate(output, bitrate);
+    }
+
+    // a failing abandoned worker must not close the session of its replacement
+    static void
+    worker_shutdown(EncodeThreadContext* thread_ctx)
+    {
+        std::lock_guard<std::mutex> guard(thread_ctx->publish);
+        if(!thread_ctx->abandoned.load())
+            RAISE_EVENT(thread_ctx->shutdown_event);
+    }
+
 
     /**
      * @brief 
      * 
-     * @param frame_nr 
+     * @param pts capture time on the PTS_CLOCK_RATE clock
      * @param session 
      * @param frame 
      * @param packets 
      * @return int 
      */
     bool
-    encode(int frame_nr, 
+    encode(int64 pts, 
            util::Buffer* session_buf, 
            libav::Frame* frame, 
-           util::QueueArray* packets) 
+           util::QueueArray* packets,
+           PacketSink sink,
+           pointer data) 
     {
         int ret;
         util::Buffer* pkt = NULL;
         Session* session      = (Session*)BUFFER_CLASS->ref(session_buf,NULL);
         libav::CodecContext* libav_ctx = session->encode->context;
-        frame->pts = (int64_t)frame_nr;
+
+        if(session->sw_frame) {
+            // software codec read the gpu converted image from system memory
+            ret = av_hwframe_transfer_data(session->sw_frame, frame, 0);
+            if(ret < 0) {
+                char err_str[AV_ERROR_MAX_STRING_SIZE] { 0 };
+                LOG_ERROR(av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret));
+                BUFFER_CLASS->unref(session_buf);
+                return FALSE;
+            }
+            av_frame_copy_props(session->sw_frame, frame);
+            frame = session->sw_frame;
+        }
+
+        if(session->sws) {
+            sws_scale(session->sws, 
+                      frame->data, frame->linesize, 0, frame->height,
+                      session->codec_frame->data, session->codec_frame->linesize);
+            av_frame_copy_props(session->codec_frame, frame);
+            frame = session->codec_frame;
+        }
+        frame->pts = pts;
+
+        if(session->stripes) {
+            bool result = stripe_group_encode(session->stripes, frame, packets, sink, data);
+            BUFFER_CLASS->unref(session_buf);
+            return result;
+        }
 
         /* send the frame to the encoder */
         ret = avcodec_send_frame(libav_ctx, frame);
@@ -104,6 +311,8 @@ namespace encoder {
         QUEUE_ARRAY_CLASS->push(packets,pkt);
         BUFFER_CLASS->unref(session_buf);
         BUFFER_CLASS->unref(pkt);
+        if(sink)
+            sink(packets, data);
         return TRUE;
     }
 
@@ -111,6 +320,118 @@ namespace encoder {
 
 
 
+    /**
+     * @brief 
+     * color conversion and downscale are done in the same gpu pass,
+     * into the frame of the rendition device
+     * 
+     * @return bool 
+     */
+    bool
+    encode_rendition(EncodeThreadContext* thread_ctx,
+                     Rendition* rendition,
+                     platf::Image* img,
+                     int64 pts)
+    {
+        if(!rendition->session)
+            return TRUE;
+
+        Session* session = (Session*)BUFFER_CLASS->ref(rendition->session,NULL);
+        platf::Device* device = session->encode->device;
+        libav::Frame* frame = device->frame;
+
+        // renditions follow the framerate of the main stream
+        if(session->config.framerate != thread_ctx->config.framerate &&
+           reconfigure(session, rendition->config.bitrate, thread_ctx->config.framerate)) {
+            thread_ctx->recreate = TRUE;
+            BUFFER_CLASS->unref(rendition->session);
+            return TRUE;
+        }
+
+        if(worker_take_idr(thread_ctx, rendition->keyframe)) {
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            frame->key_frame = 1;
+        }
+
+        bool ret = TRUE;
+        Publication publication = { thread_ctx, rendition->packet_queue, rendition->keyframe };
+        if(device->klass->convert(device,img)) {
+            LOG_ERROR("Could not convert image");
+            ret = FALSE;
+        } else if(!encode(pts, rendition->session, frame, thread_ctx->staging, worker_publish, &publication)) {
+            LOG_ERROR("Could not encode video packet");
+            ret = FALSE;
+        }
+
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        frame->key_frame = 0;
+
+        BUFFER_CLASS->unref(rendition->session);
+        if(!ret)
+            worker_shutdown(thread_ctx);
+        return ret;
+    }
+
+    /**
+     * @brief 
+     * capture timestamp on the PTS_CLOCK_RATE clock, shared by every rendition
+     */
+    int64
+    capture_pts(EncodeThreadContext* thread_ctx,
+                platf::Image* img)
+    {
+        if(!thread_ctx->epoch)
+            thread_ctx->epoch = img->timestamp;
+
+        int64 pts = av_rescale(img->timestamp - thread_ctx->epoch, PTS_CLOCK_RATE, 1000000000);
+
+        // two pictures presented within one tick must still be ordered
+        pts = MAX(pts, thread_ctx->last_pts + 1);
+        thread_ctx->last_pts = pts;
+        return pts;
+    }
+
+    /**
+     * @brief 
+     * main stream and renditions share the codec
+     */
+    void
+    use_h264(EncodeThreadContext* thread_ctx)
+    {
+        thread_ctx->config.videoFormat = 0;
+        for(int i = 0; i < thread_ctx->simulcast_count; i++)
+            thread_ctx->simulcast[i].config.videoFormat = 0;
+    }
+
+    /**
+     * @brief 
+     * an unchanged slot is only encoded when a receiver wait for a keyframe 
+     * or when the keepalive interval is over, the repeat then cost a few skipped macroblocks
+     * 
+     * @return bool 
+     */
+    bool
+    frame_needed(EncodeThreadContext* thread_ctx,
+                 platf::Image* img)
+    {
+        int64 now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        bool needed = !img->unchanged || 
+                      ENCODER_CONFIG->idle_keepalive <= 0 ||
+                      now - thread_ctx->last_encode >= (int64)ENCODER_CONFIG->idle_keepalive * 1000000 ||
+                      worker_idr_pending(thread_ctx, thread_ctx->keyframe);
+
+        for(int i = 0; !needed && i < thread_ctx->simulcast_count; i++)
+            needed = worker_idr_pending(thread_ctx, thread_ctx->simulcast[i].keyframe);
+
+        if(needed)
+            thread_ctx->last_encode = now;
+        else
+            thread_ctx->idle++;
+        return needed;
+    }
+
     /**
      * @brief 
      * 
@@ -119,9 +440,9 @@ namespace encoder {
      * @return platf::Capture 
      */
     platf::Capture
-    on_image_snapshoot (platf::Image** img,
-                        util::Buffer* buffer,
-                        EncodeThreadContext* thread_ctx)
+    process_image (platf::Image** img,
+                   util::Buffer* buffer,
+                   EncodeThreadContext* thread_ctx)
     {
         Session* session = (Session*)BUFFER_CLASS->ref(buffer,NULL);
         platf::Device* device = session->encode->device;
@@ -137,65 +458,264 @@ namespace encoder {
             return platf::Capture::error;
         }
 
+        // bitrate and framerate may be changed by the client while streaming
+        thread_ctx->config.bitrate   = ENCODER_CONFIG->conf.bitrate;
+        thread_ctx->config.framerate = ENCODER_CONFIG->conf.framerate;
+        if(session->config.bitrate   != thread_ctx->config.bitrate ||
+           session->config.framerate != thread_ctx->config.framerate) {
+            int framerate = thread_ctx->config.framerate;
+            if(reconfigure(session, thread_ctx->config.bitrate, framerate)) {
+                thread_ctx->recreate = TRUE;
+                BUFFER_CLASS->unref(buffer);
+                return platf::Capture::reinit;
+            }
+            thread_ctx->display->klass->set_framerate(thread_ctx->display, framerate);
+            if(!thread_ctx->cost.judged)
+                cost_monitor_reset(&thread_ctx->cost, framerate);
+            worker_publish_bitrate(thread_ctx, thread_ctx->output, thread_ctx->config.bitrate);
+        }
+
+        // nothing new on screen, the receiver keep showing the last frame
+        if(!frame_needed(thread_ctx, *img)) {
+            BUFFER_CLASS->unref(buffer);
+            return platf::Capture::ok;
+        }
+
+        heartbeat_enter(thread_ctx->beat, CODEC_STAGE);
+        if(worker_take_idr(thread_ctx, thread_ctx->keyframe)) {
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            frame->key_frame = 1;
+        }
+
         // convert image
         if(device->klass->convert(device,*img)) {
             LOG_ERROR("Could not convert image");
-            RAISE_EVENT(thread_ctx->shutdown_event);
+            worker_shutdown(thread_ctx);
             BUFFER_CLASS->unref(buffer);
             return platf::Capture::error;
         }
 
         // encode
-        if(!encode(thread_ctx->frame_nr++, 
-                buffer, 
-                frame, 
-                thread_ctx->packet_queue)) {
+        // pts is the capture time, dropped or skipped slots leave a real gap
+        int64 pts = capture_pts(thread_ctx, *img);
+        auto encode_start = std::chrono::steady_clock::now();
+
+        // streamed stripes are published one by one from inside the encode
+        Publication publication = { thread_ctx, thread_ctx->packet_queue, thread_ctx->keyframe };
+        bool encoded = encode(pts, 
+                              buffer, 
+                              frame, 
+                              thread_ctx->staging,
+                              worker_publish,
+                              &publication);
+        if(!encoded) {
             LOG_ERROR("Could not encode video packet");
-            RAISE_EVENT(thread_ctx->shutdown_event);
+            worker_shutdown(thread_ctx);
             BUFFER_CLASS->unref(buffer);
             return platf::Capture::error;
         }
 
+        if(session->config.videoFormat == 1 && ENCODER_CONFIG->hevc_fallback) {
+            int64 elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - encode_start).count();
+
+            // receivers already decode HEVC, the next session open H.264 instead
+            if(cost_monitor_add(&thread_ctx->cost, elapsed)) {
+                LOG_WARNING("HEVC encode does not fit in the frame interval, later sessions will use H.264");
+                set_h264_only(thread_ctx->encoder, thread_ctx->display, &thread_ctx->config);
+            }
+        }
+
         // reset keyframe attribute
-        // frame->pict_type = AV_PICTURE_TYPE_NONE;
-        // frame->key_frame = 0;
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        frame->key_frame = 0;
+
+        // same captured image, each rendition convert and scale on its own device
+        for(int i = 0; i < thread_ctx->simulcast_count; i++) {
+            if(!encode_rendition(thread_ctx, &thread_ctx->simulcast[i], *img, pts)) {
+                BUFFER_CLASS->unref(buffer);
+                return platf::Capture::error;
+            }
+        }
 
         BUFFER_CLASS->unref(buffer);
-        return platf::Capture::ok;
+        return thread_ctx->recreate ? platf::Capture::reinit : platf::Capture::ok;
     }
 
+    platf::Capture
+    on_image_snapshoot (platf::Image** img,
+                        util::Buffer* buffer,
+                        EncodeThreadContext* thread_ctx)
+    {
+        if(thread_ctx->abandoned.load())
+            return platf::Capture::error;
 
+        platf::Capture status = process_image(img, buffer, thread_ctx);
 
+        // the wait for the next image start here, an idle slot may be long
+        heartbeat_slot(thread_ctx->beat, (int)(thread_ctx->display->slot / 1000000));
+        heartbeat_enter(thread_ctx->beat, CAPTURE_STAGE);
+        return status;
+    }
 
-    // TODO add encoder and display to context
-    platf::Capture
-    encode_run_sync(EncodeThreadContext* ctx) 
+
+
+
+    /**
+     * @brief 
+     * publish codec parameters of every stream to the network side
+     */
+    void
+    publish_streams(rtp::RtpOutput* output,
+                    util::Buffer* buffer)
+    {
+        Session* session = (Session*)BUFFER_CLASS->ref(buffer,NULL);
+        if(session->stripes) {
+            for(int i = 0; i < stripe_group_count(session->stripes); i++)
+                rtp::register_stream(output, stripe_group_context(session->stripes, i), i);
+        } else {
+            rtp::register_stream(output, session->encode, 0);
+        }
+        rtp::set_output_bitrate(output, session->config.bitrate);
+        BUFFER_CLASS->unref(buffer);
+    }
+
+    // an abandoned worker must not replace the streams of its replacement
+    static void
+    worker_publish_streams(EncodeThreadContext* ctx,
+                           rtp::RtpOutput* output,
+                           util::Buffer* buffer)
+    {
+        std::lock_guard<std::mutex> guard(ctx->publish);
+        if(!ctx->abandoned.load())
+            publish_streams(output, buffer);
+    }
+
+    void
+    free_capture_session(EncodeThreadContext* ctx)
+    {
+        if(ctx->session) {
+            BUFFER_CLASS->unref(ctx->session);
+            ctx->session = NULL;
+        }
+
+        for(int i = 0; i < ctx->simulcast_count; i++) {
+            if(ctx->simulcast[i].session) {
+                BUFFER_CLASS->unref(ctx->simulcast[i].session);
+                ctx->simulcast[i].session = NULL;
+            }
+        }
+    }
+
+    /**
+     * @brief 
+     * (re)build display image and encode session from the current display output
+     * 
+     * @param ctx 
+     * @return bool 
+     */
+    bool
+    make_capture_session(EncodeThreadContext* ctx)
     {
+        heartbeat_enter(ctx->beat, SETUP_STAGE);
+        free_capture_session(ctx);
+
+        if(ctx->img) {
+            ctx->display->klass->free_img(ctx->display,ctx->img);
+            ctx->img = NULL;
+        }
+
+        // the codec is chosen once per session, a rebuilt codec or a replacement worker 
+        // keep what the receivers were told, otherwise a previous session may have found HEVC too heavy
+        libav::CodecID described = rtp::stream_codec(ctx->output, 0);
+        if(described != AV_CODEC_ID_NONE) {
+            if(described == AV_CODEC_ID_H264)
+                use_h264(ctx);
+        } else if(ctx->config.videoFormat == 1 && ENCODER_CONFIG->hevc_fallback &&
+                  h264_only(ctx->encoder, ctx->display, &ctx->config)) {
+            use_h264(ctx);
+        }
+
+        // the probe window restart with the codec until it has been judged
+        if(!ctx->cost.judged)
+            cost_monitor_reset(&ctx->cost, ctx->config.framerate);
+
         // allocate display image and intialize with dummy data
-        platf::Image* img = ctx->display->klass->alloc_img(ctx->display);
-        if(!img || ctx->display->klass->dummy_img(ctx->display,img)) 
-            return platf::Capture::error;
+        ctx->img = ctx->display->klass->alloc_img(ctx->display);
+        if(!ctx->img || ctx->display->klass->dummy_img(ctx->display,ctx->img)) 
+            return FALSE;
 
-        util::Buffer* buf = make_session_buffer(img, 
-                                                ctx->encoder,
-                                                ctx->display,
-                                                ctx->config);
-        if(!buf)
-            return platf::Capture::error;
+        ctx->session = make_session_buffer(ctx->img, 
+                                           ctx->encoder,
+                                           ctx->display,
+                                           &ctx->config);
+        if(!ctx->session)
+            return FALSE;
+
+        worker_publish_streams(ctx, ctx->output, ctx->session);
+
+        for(int i = 0; i < ctx->simulcast_count; i++) {
+            Rendition* rendition = &ctx->simulcast[i];
+            rendition->config.framerate = ctx->config.framerate;
+            rendition->session = make_session_buffer(ctx->img, 
+                                                     ctx->encoder,
+                                                     ctx->display,
+                                                     &rendition->config);
+
+            // a rendition the encoder cannot open does not stop the main stream
+            if(!rendition->session) {
+                LOG_WARNING("unable to create simulcast rendition");
+                continue;
+            }
+            worker_publish_streams(ctx, rendition->output, rendition->session);
+        }
+
+        ctx->display->klass->set_framerate(ctx->display, ctx->config.framerate);
+        return TRUE;
+    }
+
+    /**
+     * @brief 
+     * rebuild capture side only, codec is kept unless output size or format changed
+     * 
+     * @param ctx 
+     * @return bool 
+     */
+    bool
+    reinit_capture(EncodeThreadContext* ctx)
+    {
+        while(!ctx->abandoned.load() && !IS_INVOKED(ctx->shutdown_event)) {
+            // waiting for the output is not a stall
+            heartbeat_enter(ctx->beat, SETUP_STAGE);
+            int changed = ctx->display->klass->reinit(ctx->display);
+            if(changed < 0) {
+                // output may be unavailable for a moment (secure desktop, mode switch)
+                std::this_thread::sleep_for(200ms);
+                continue;
+            }
+
+            return changed ? make_capture_session(ctx) : TRUE;
+        }
+        return FALSE;
+    }
+
+    platf::Capture
+    encode_run_sync(EncodeThreadContext* ctx) 
+    {
+        heartbeat_enter(ctx->beat, CAPTURE_STAGE);
 
         // cursor
         // run image capture in while loop, 
-        platf::Capture ret = ctx->display->klass->capture(ctx->display, 
-                                                    img,
-                                                    (platf::SnapshootCallback)on_image_snapshoot, 
-                                                    buf, 
-                                                    ctx,
-                                                    FALSE);
-        
-        BUFFER_CLASS->unref(buf);
-        return ret;
+        return ctx->display->klass->capture(ctx->display, 
+                                            ctx->img,
+                                            (platf::SnapshootCallback)on_image_snapshoot, 
+                                            ctx->session, 
+                                            ctx,
+                                            FALSE);
     }
 
+    void                free_capture_worker     (EncodeThreadContext* ctx);
+
     /**
      * @brief 
      * 
@@ -206,7 +726,7 @@ namespace encoder {
     {
         // start capture thread sync thread and create a reference to its context
         platf::Display* disp;
-        Encoder* encoder = NVENC;
+        Encoder* encoder = strcmp(ENCODER_CONFIG->encoder,"software") == 0 ? SOFTWARE : NVENC;
 
         // display selection
         {
@@ -226,7 +746,8 @@ namespace encoder {
                 count++;
             }
 
-            // reset display every 200ms until display is ready
+            // reset display every 200ms until display is ready,
+            // every worker own its duplication, capture grid and counters
             disp = platf::tryget_display(encoder->dev_type, 
                                          chosen_display, 
                                          ENCODER_CONFIG->framerate);
@@ -239,49 +760,232 @@ namespace encoder {
         ctx->display = disp;
         ctx->encoder = encoder;
 
+        // session is created once and reused for every capture call
+        if(!make_capture_session(ctx)) {
+            LOG_ERROR("unable to create encode session");
+            goto done;
+        }
 
-        // run encoder in infinite loop
-        while(TRUE) {
+        while(!ctx->abandoned.load() && !IS_INVOKED(ctx->shutdown_event)) {
             platf::Capture result = encode_run_sync(ctx);
             switch (result)
             {
+            case platf::Capture::reinit:
+                if(ctx->recreate) {
+                    // config change the open codec cannot take
+                    ctx->recreate = FALSE;
+                    if(!make_capture_session(ctx)) 
+                        goto done;
+                    continue;
+                }
+
+                if(!reinit_capture(ctx)) 
+                    goto done;
+                continue;
             case platf::Capture::error:
-                break;
+                if(ctx->abandoned.load() || IS_INVOKED(ctx->shutdown_event)) 
+                    goto done;
+
+                // unknown capture failure, rebuild everything
+                if(!make_capture_session(ctx)) 
+                    goto done;
+                continue;
             default:
                 continue;
             }
         }
         done:
-        RAISE_EVENT(ctx->shutdown_event);
-        RAISE_EVENT(ctx->join_event);
+        if(ctx->display && ctx->display->dropped) {
+            char log[128] = {0};
+            snprintf(log, sizeof(log), "encoder was behind, %llu of %lld capture slots dropped",
+                     (unsigned long long)ctx->display->dropped,
+                     (long long)ctx->display->frame_index);
+            LOG_WARNING(log);
+        }
+
+        // the requests belong to the session, an abandoned worker leave them alone
+        if(!ctx->abandoned.load()) {
+            for(int i = -1; i < ctx->simulcast_count; i++) {
+                IdrStats stats = {0};
+                idr_stats(i < 0 ? ctx->keyframe : ctx->simulcast[i].keyframe, &stats);
+                if(!stats.requested)
+                    continue;
+
+                char log[128] = {0};
+                snprintf(log, sizeof(log), "stream %d keyframes, %llu requested %llu coalesced %llu issued",
+                         i + 1,
+                         (unsigned long long)stats.requested,
+                         (unsigned long long)stats.coalesced,
+                         (unsigned long long)stats.issued);
+                LOG_DEBUG(log);
+            }
+        }
+
+        free_capture_session(ctx);
+        if(ctx->img)
+            ctx->display->klass->free_img(ctx->display,ctx->img);
+
+        if(ctx->display) {
+            ctx->display->klass->finalize(ctx->display);
+            ctx->display = NULL;
+        }
+
+        // a replacement worker already own the network side,
+        // the watchdog either abandoned this worker or see the join event, never both
+        {
+            std::lock_guard<std::mutex> guard(ctx->publish);
+            if(!ctx->abandoned.load()) {
+                RAISE_EVENT(ctx->shutdown_event);
+                RAISE_EVENT(ctx->join_event);
+                return;
+            }
+        }
+
+        Stragglers* stragglers = ctx->stragglers;
+        free_capture_worker(ctx);
+        stragglers_done(stragglers);
+    }
+
+    /**
+     * @brief 
+     * worker context is shared with a thread the watchdog may abandon,
+     * so it live on the heap instead of the stack of capture
+     */
+    EncodeThreadContext*
+    make_capture_worker(util::Broadcaster* shutdown_event,
+                        rtp::RtpOutput** outputs,
+                        IdrRequest** keyframes,
+                        int count,
+                        Stragglers* stragglers)
+    {
+        EncodeThreadContext* ctx = (EncodeThreadContext*)malloc(sizeof(EncodeThreadContext));
+        memset((pointer)ctx,0,sizeof(EncodeThreadContext));
+        new (&ctx->thread) std::thread();
+        new (&ctx->abandoned) std::atomic<bool>(FALSE);
+        new (&ctx->publish) std::mutex();
+        ctx->staging = QUEUE_ARRAY_CLASS->init();
+        ctx->stragglers = stragglers;
+
+        ctx->shutdown_event = shutdown_event;
+        ctx->join_event = NEW_EVENT;
+        ctx->output = outputs[0];
+        ctx->packet_queue = rtp::rtp_output_queue(outputs[0]);
+        ctx->keyframe = keyframes[0];
+        ctx->beat = make_heartbeat();
+
+        ctx->config = ENCODER_CONFIG->conf;
+
+        // every output after the first one receive a simulcast rendition
+        ctx->simulcast_count = MIN(count - 1, ENCODER_CONFIG->simulcast_count);
+        for(int i = 0; i < ctx->simulcast_count; i++) {
+            Rendition* rendition    = &ctx->simulcast[i];
+            config::Rendition* conf = &ENCODER_CONFIG->simulcast[i];
+
+            rendition->config         = ENCODER_CONFIG->conf;
+            rendition->config.width   = conf->width;
+            rendition->config.height  = conf->height;
+            rendition->config.bitrate = conf->bitrate;
+            rendition->output         = outputs[i + 1];
+            rendition->packet_queue   = rtp::rtp_output_queue(outputs[i + 1]);
+            rendition->keyframe       = keyframes[i + 1];
+        }
+
+        ctx->thread = std::thread {captureThread, ctx };
+        return ctx;
+    }
+
+    void
+    free_capture_worker(EncodeThreadContext* ctx)
+    {
+        heartbeat_finalize(ctx->beat);
+        QUEUE_ARRAY_CLASS->stop(ctx->join_event);
+        QUEUE_ARRAY_CLASS->stop(ctx->staging);
+        ctx->thread.~thread();
+        ctx->abandoned.~atomic();
+        ctx->publish.~mutex();
+        free(ctx);
     }
 
     /**
      * @brief 
      * 
      * @param shutdown_event 
-     * @param packet_queue 
-     * @param config 
-     * @param data 
+     * @param outputs 
+     * @param keyframes 
+     * @param count 
+     * @param stalled 
      */
     void 
     capture( util::Broadcaster* shutdown_event,
-             util::QueueArray* packet_queue) 
+             rtp::RtpOutput** outputs,
+             IdrRequest** keyframes,
+             int count,
+             int* stalled) 
     {
-        util::Broadcaster* join_event = NEW_EVENT;
+        Stragglers* stragglers = make_stragglers();
+        EncodeThreadContext* ctx = make_capture_worker(shutdown_event, outputs, keyframes, count, stragglers);
+
+        auto last_restart = std::chrono::steady_clock::now();
+        int restarts = 0;
 
-        // push new session context to concode queue
-        EncodeThreadContext ss_ctx = {0};
-        ss_ctx.shutdown_event = shutdown_event;
-        ss_ctx.join_event = join_event;
-        ss_ctx.packet_queue = packet_queue;
+        // watchdog, a worker stuck in a stage is replaced while viewers stay connected
+        while(!IS_INVOKED(ctx->join_event)) {
+            std::this_thread::sleep_for(WATCHDOG_INTERVAL);
 
-        ss_ctx.config = &ENCODER_CONFIG->conf;
-        ss_ctx.frame_nr = 1;
-        ss_ctx.thread = std::thread {captureThread, &ss_ctx };
+            int stalled_ms = 0;
+            Stage stage = heartbeat_stalled(ctx->beat, ENCODER_CONFIG->watchdog_timeout, &stalled_ms);
+            if(stage == MAX_STAGE)
+                continue;
+
+            // the stuck thread cannot be interrupted, leave it behind.
+            // once abandoned is set the worker free its own context and publish nothing
+            {
+                std::lock_guard<std::mutex> guard(ctx->publish);
+                if(IS_INVOKED(ctx->join_event))
+                    break;
+
+                stragglers_add(stragglers);
+                ctx->thread.detach();
+                ctx->abandoned.store(TRUE);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            restarts = now - last_restart < WATCHDOG_RESTART_WINDOW ? restarts + 1 : 1;
+            last_restart = now;
+
+            char log[128] = {0};
+            snprintf(log, sizeof(log), "%s stage stalled for %dms, restarting capture worker (%d in a row)",
+                     stage_name(stage), stalled_ms, restarts);
+            LOG_WARNING(log);
+
+            if(IS_INVOKED(shutdown_event) || restarts > WATCHDOG_MAX_RESTARTS) {
+                LOG_ERROR("capture worker keep stalling, closing session");
+                RAISE_EVENT(shutdown_event);
+                ctx = NULL;
+                break;
+            }
+
+            // new worker open its own display and codec, 
+            // the first frame of a fresh codec is a keyframe for every viewer
+            ctx = make_capture_worker(shutdown_event, outputs, keyframes, count, stragglers);
+        }
+
+        if(ctx) {
+            ctx->thread.join();
+            free_capture_worker(ctx);
+        }
+
+        // a stuck worker that wake up still use the outputs until it see it was abandoned
+        int alive = stragglers_wait(stragglers, WATCHDOG_STRAGGLER_WAIT);
+        if(alive) {
+            char log[128] = {0};
+            snprintf(log, sizeof(log), "%d abandoned capture worker still running", alive);
+            LOG_ERROR(log);
+        }
+        stragglers_release(stragglers);
 
-        // Wait for join signal
-        WAIT_EVENT(join_event);
+        if(stalled)
+            *stalled = alive;
     }
 
 
@@ -14,6 +14,9 @@
 
 #include <sunshine_util.h>
 #include <encoder_device.h>
+#include <encoder_datatype.h>
+
+#include <encoder_idr.h>
 
 #include <thread>
 
@@ -24,20 +27,37 @@ namespace encoder
 
     /**
      * @brief 
+     * capture and encode until shutdown_event, 
+     * a watchdog replace the worker when it stall
      * 
-     * @param shutdown_event 
-     * @param packet_queue 
-     * @param config 
-     * @param data 
+     * @param shutdown_event raised on fatal failure, capture return once it is raised
+     * @param outputs   outputs[0] receive the main stream, 
+     *                  the next ones receive the simulcast renditions of the encoder config
+     * @param keyframes keyframe request of each output
+     * @param count     number of outputs
+     * @param stalled   receive the number of abandoned workers still running on return,
+     *                  outputs and keyframes must then be left allocated
      */
     void                capture          (util::Broadcaster* shutdown_event,
-                                          util::QueueArray* packet_queue);
+                                          rtp::RtpOutput** outputs,
+                                          IdrRequest** keyframes,
+                                          int count,
+                                          int* stalled);
     
 
-    bool                 encode           (int frame_nr, 
+    void                free_av_packet   (void* pkt);
+
+    /**
+     * @brief 
+     * encoded packets are pushed to packets, then handed to sink when it is not NULL.
+     * streamed stripes reach sink one by one, before the whole frame is encoded
+     */
+    bool                 encode           (int64 pts, 
                                           util::Buffer* sync_session, 
                                           libav::Frame* frame, 
-                                          util::QueueArray* packets);
+                                          util::QueueArray* packets,
+                                          PacketSink sink,
+                                          pointer data);
 } // namespace error
 
 
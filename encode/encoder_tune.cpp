@@ -0,0 +1,203 @@
+/**
+ * @file encoder_tune.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-30
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <encoder_tune.h>
+
+#include <sunshine_util.h>
+#include <sunshine_config.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+// calibration encode, small enough to finish well under a second
+#define CALIBRATION_WIDTH       640
+#define CALIBRATION_HEIGHT      360
+#define CALIBRATION_FRAMES      60
+
+// pixel per second one thread sustain at the default superfast preset
+#define DEFAULT_H264_THROUGHPUT (40 * 1000 * 1000LL)
+#define DEFAULT_HEVC_THROUGHPUT (10 * 1000 * 1000LL)
+
+// encode must fit in 80% of the frame interval
+#define TUNE_LOAD_PERCENT       80
+
+namespace encoder
+{
+    /**
+     * @brief 
+     * single threaded encode of a moving gradient, 
+     * return pixel per second or -1
+     */
+    static int64
+    calibrate(char* codec_name)
+    {
+        libav::Codec* codec = avcodec_find_encoder_by_name(codec_name);
+        if(!codec)
+            return -1;
+
+        libav::CodecContext* ctx = avcodec_alloc_context3(codec);
+        if(!ctx)
+            return -1;
+
+        ctx->width        = CALIBRATION_WIDTH;
+        ctx->height       = CALIBRATION_HEIGHT;
+        ctx->time_base    = AVRational { 1, 60 };
+        ctx->framerate    = AVRational { 60, 1 };
+        // planar input is taken by both x264 and x265
+        ctx->pix_fmt      = AV_PIX_FMT_YUV420P;
+        ctx->max_b_frames = 0;
+        ctx->gop_size     = INT_MAX;
+        ctx->thread_type  = FF_THREAD_SLICE;
+        ctx->thread_count = 1;
+        ctx->slices       = 1;
+        ctx->bit_rate     = 4 * 1000 * 1000;
+        ctx->flags       |= AV_CODEC_FLAG_LOW_DELAY;
+
+        AVDictionary* options = NULL;
+        av_dict_set(&options, "preset", ENCODER_CONFIG->sw.preset, 0);
+        av_dict_set(&options, "tune", ENCODER_CONFIG->sw.tune, 0);
+        // x265 ignore thread_count, its own pools and frame threads must be pinned to one
+        if(strcmp(codec_name, "libx265") == 0)
+            av_dict_set(&options, "x265-params", "pools=1:frame-threads=1", 0);
+        int status = avcodec_open2(ctx, codec, &options);
+        av_dict_free(&options);
+        if(status < 0) {
+            avcodec_free_context(&ctx);
+            return -1;
+        }
+
+        libav::Frame* frame = av_frame_alloc();
+        frame->format = ctx->pix_fmt;
+        frame->width  = ctx->width;
+        frame->height = ctx->height;
+        libav::Packet* packet = av_packet_alloc();
+        if(av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            av_packet_free(&packet);
+            avcodec_free_context(&ctx);
+            return -1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = TRUE;
+        for(int i = 0; ok && i < CALIBRATION_FRAMES; i++) {
+            // content must change every frame, otherwise everything is skipped
+            for(int y = 0; y < frame->height; y++) 
+                for(int x = 0; x < frame->width; x++) 
+                    frame->data[0][y * frame->linesize[0] + x] = (uint8)(x + y * 2 + i * 4);
+            memset(frame->data[1], 128, frame->linesize[1] * frame->height / 2);
+            memset(frame->data[2], 128, frame->linesize[2] * frame->height / 2);
+            frame->pts = i;
+
+            ok = avcodec_send_frame(ctx, frame) >= 0;
+            while(ok && avcodec_receive_packet(ctx, packet) >= 0)
+                av_packet_unref(packet);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&ctx);
+
+        int64 us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        if(!ok || us <= 0)
+            return -1;
+
+        return (int64)CALIBRATION_WIDTH * CALIBRATION_HEIGHT * CALIBRATION_FRAMES * 1000000 / us;
+    }
+
+    /**
+     * @brief 
+     * single thread throughput of codec, from cache, calibration or default
+     */
+    static int64
+    thread_throughput(CodecConfig* codec)
+    {
+        bool hevc = strstr(codec->name, "265") || strstr(codec->name, "hevc");
+        int64 throughput = hevc ? DEFAULT_HEVC_THROUGHPUT : DEFAULT_H264_THROUGHPUT;
+        if(!ENCODER_CONFIG->sw.calibrate)
+            return throughput;
+        if(codec->throughput > 0)
+            return codec->throughput;
+
+        char key[CACHE_MAX_LINE / 2] = {0};
+        char value[64] = {0};
+        snprintf(key, sizeof(key), "throughput:%s:%s:%s:%u:%u",
+                 codec->name,
+                 ENCODER_CONFIG->sw.preset,
+                 ENCODER_CONFIG->sw.tune,
+                 avcodec_version(),
+                 std::thread::hardware_concurrency());
+
+        long long cached;
+        bool cacheable = ENCODER_CONFIG->cache_path != NULL;
+        if(cacheable &&
+           util::cache_get(ENCODER_CONFIG->cache_path, key, value, sizeof(value)) &&
+           sscanf(value, "%lld", &cached) == 1 && cached > 0) {
+            codec->throughput = cached;
+            return cached;
+        }
+
+        int64 measured = calibrate(codec->name);
+        if(measured <= 0) {
+            LOG_WARNING("encoder calibration failed, using default throughput");
+            return throughput;
+        }
+
+        if(cacheable) {
+            snprintf(value, sizeof(value), "%lld", (long long)measured);
+            util::cache_set(ENCODER_CONFIG->cache_path, key, value);
+        }
+        codec->throughput = measured;
+        return measured;
+    }
+
+    int
+    tune_threads(CodecConfig* codec,
+                 Config* config,
+                 int instances)
+    {
+        int min_threads = MAX(ENCODER_CONFIG->sw.min_threads, 1);
+        if(!ENCODER_CONFIG->sw.auto_tune)
+            return min_threads;
+
+        instances = MAX(instances, 1);
+        int cores = (int)std::thread::hardware_concurrency();
+        if(cores <= 0)
+            return min_threads;
+
+        // leave one core for capture and the sender
+        int budget = MAX(cores - 1, 1) / instances;
+
+        int64 pixel_rate = (int64)config->width * config->height * config->framerate / instances;
+        int64 throughput = thread_throughput(codec) * TUNE_LOAD_PERCENT / 100;
+        int threads = (int)((pixel_rate + throughput - 1) / throughput);
+
+        // slice threading need at least one macroblock row per thread
+        int rows = config->height / instances / 16;
+        threads = MIN(threads, budget);
+        threads = MIN(threads, MAX(rows, 1));
+        return MAX(threads, min_threads);
+    }
+
+    void
+    tune_calibrate(CodecConfig* codec)
+    {
+        if(ENCODER_CONFIG->sw.auto_tune)
+            thread_throughput(codec);
+    }
+} // namespace encoder
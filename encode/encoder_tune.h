@@ -0,0 +1,45 @@
+/**
+ * @file encoder_tune.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-30
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __ENCODER_TUNE_H__
+#define __ENCODER_TUNE_H__
+
+#include <sunshine_util.h>
+#include <encoder_datatype.h>
+#include <encoder_device.h>
+
+namespace encoder
+{
+    /**
+     * @brief 
+     * pick the slice thread count of one software codec instance 
+     * from core count, resolution and framerate.
+     * 
+     * throughput of a single thread is measured once by a short calibration encode
+     * when sw.calibrate is set, and persisted in the encoder cache
+     * 
+     * @param codec     codec the session will open
+     * @param config    stream configuration
+     * @param instances number of codec instance sharing the cpu (stripes)
+     * @return int      thread count, never lower than sw.min_threads
+     */
+    int                 tune_threads            (CodecConfig* codec,
+                                                 Config* config,
+                                                 int instances);
+
+    /**
+     * @brief 
+     * run the calibration of codec ahead of time and keep it in codec,
+     * sessions opened side by side (probes) then share it instead of calibrating together
+     */
+    void                tune_calibrate          (CodecConfig* codec);
+} // namespace encoder
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * @file encoder_watchdog.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <encoder_watchdog.h>
+#include <sunshine_util.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string.h>
+
+#define SETUP_THRESHOLD_FACTOR 10
+
+namespace encoder
+{
+    struct _Heartbeat {
+        /**
+         * @brief
+         * stage is published after since,
+         * so that the watchdog never pair a new stage with an old timestamp
+         */
+        std::atomic<int> stage;
+        std::atomic<int64> since;
+
+        // extra capture threshold in ms, see heartbeat_slot
+        std::atomic<int> slot;
+    };
+
+    struct _Stragglers {
+        std::mutex lock;
+        std::condition_variable exited;
+
+        int alive;
+        bool released;
+    };
+
+    static int64
+    now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Heartbeat*
+    make_heartbeat()
+    {
+        Heartbeat* beat = (Heartbeat*)malloc(sizeof(Heartbeat));
+        memset((pointer)beat,0,sizeof(Heartbeat));
+        new (&beat->stage) std::atomic<int>(SETUP_STAGE);
+        new (&beat->since) std::atomic<int64>(now_ns());
+        new (&beat->slot) std::atomic<int>(0);
+        return beat;
+    }
+
+    void
+    heartbeat_enter(Heartbeat* beat,
+                    Stage stage)
+    {
+        beat->since.store(now_ns());
+        beat->stage.store(stage);
+    }
+
+    void
+    heartbeat_slot(Heartbeat* beat,
+                   int slot_ms)
+    {
+        beat->slot.store(MAX(slot_ms, 0));
+    }
+
+    Stage
+    heartbeat_stalled(Heartbeat* beat,
+                      int threshold_ms,
+                      int* stalled_ms)
+    {
+        Stage stage = (Stage)beat->stage.load();
+        int64 elapsed = (now_ns() - beat->since.load()) / 1000000;
+        int64 threshold = threshold_ms;
+        if(stage == SETUP_STAGE)
+            threshold *= SETUP_THRESHOLD_FACTOR;
+        else if(stage == CAPTURE_STAGE)
+            threshold += beat->slot.load();
+
+        if(threshold_ms <= 0 || elapsed < threshold)
+            return MAX_STAGE;
+
+        if(stalled_ms)
+            *stalled_ms = (int)elapsed;
+        return stage;
+    }
+
+    char*
+    stage_name(Stage stage)
+    {
+        switch(stage) {
+        case CAPTURE_STAGE:
+            return "capture";
+        case CODEC_STAGE:
+            return "codec";
+        case SETUP_STAGE:
+            return "setup";
+        default:
+            return "unknown";
+        }
+    }
+
+    void
+    heartbeat_finalize(Heartbeat* beat)
+    {
+        beat->stage.~atomic();
+        beat->since.~atomic();
+        beat->slot.~atomic();
+        free(beat);
+    }
+
+    Stragglers*
+    make_stragglers()
+    {
+        Stragglers* stragglers = (Stragglers*)malloc(sizeof(Stragglers));
+        memset((pointer)stragglers,0,sizeof(Stragglers));
+        new (&stragglers->lock) std::mutex();
+        new (&stragglers->exited) std::condition_variable();
+        return stragglers;
+    }
+
+    static void
+    free_stragglers(Stragglers* stragglers)
+    {
+        stragglers->exited.~condition_variable();
+        stragglers->lock.~mutex();
+        free(stragglers);
+    }
+
+    void
+    stragglers_add(Stragglers* stragglers)
+    {
+        std::lock_guard<std::mutex> guard(stragglers->lock);
+        stragglers->alive++;
+    }
+
+    void
+    stragglers_done(Stragglers* stragglers)
+    {
+        bool last = FALSE;
+        {
+            std::lock_guard<std::mutex> guard(stragglers->lock);
+            stragglers->alive--;
+            last = stragglers->released && !stragglers->alive;
+            stragglers->exited.notify_all();
+        }
+
+        if(last)
+            free_stragglers(stragglers);
+    }
+
+    int
+    stragglers_wait(Stragglers* stragglers,
+                    int timeout_ms)
+    {
+        std::unique_lock<std::mutex> guard(stragglers->lock);
+        stragglers->exited.wait_for(guard, std::chrono::milliseconds { timeout_ms },
+                                    [stragglers] { return !stragglers->alive; });
+        return stragglers->alive;
+    }
+
+    void
+    stragglers_release(Stragglers* stragglers)
+    {
+        bool last = FALSE;
+        {
+            std::lock_guard<std::mutex> guard(stragglers->lock);
+            stragglers->released = TRUE;
+            last = !stragglers->alive;
+        }
+
+        if(last)
+            free_stragglers(stragglers);
+    }
+} // namespace encoder
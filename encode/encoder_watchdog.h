@@ -0,0 +1,89 @@
+/**
+ * @file encoder_watchdog.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __ENCODER_WATCHDOG_H__
+#define __ENCODER_WATCHDOG_H__
+
+#include <sunshine_util.h>
+
+namespace encoder
+{
+    typedef enum _Stage{
+        CAPTURE_STAGE,          // waiting for the next captured image
+        CODEC_STAGE,            // inside the codec, from send_frame to the last packet
+        SETUP_STAGE,            // display and encode session (re)creation
+        MAX_STAGE
+    }Stage;
+
+    typedef struct _Heartbeat Heartbeat;
+
+    typedef struct _Stragglers Stragglers;
+
+    /**
+     * @brief
+     * heartbeats of one capture worker,
+     * written by the worker and read by the watchdog
+     */
+    Heartbeat*          make_heartbeat          ();
+
+    /**
+     * @brief
+     * worker entered stage, leaving it is done by entering the next one
+     */
+    void                heartbeat_enter         (Heartbeat* beat,
+                                                 Stage stage);
+
+    /**
+     * @brief
+     * longest wait for the next image once the worker entered the capture stage,
+     * added to the capture threshold so that a long idle slot is not taken for a stall
+     */
+    void                heartbeat_slot          (Heartbeat* beat,
+                                                 int slot_ms);
+
+    /**
+     * @brief
+     * return the stage the worker is stuck in for longer than its threshold,
+     * MAX_STAGE if the worker is alive.
+     * setup is given ten times the threshold, opening a codec is slow
+     */
+    Stage               heartbeat_stalled       (Heartbeat* beat,
+                                                 int threshold_ms,
+                                                 int* stalled_ms);
+
+    char*               stage_name              (Stage stage);
+
+    void                heartbeat_finalize      (Heartbeat* beat);
+
+    /**
+     * @brief
+     * count of the workers abandoned by one watchdog that are still running,
+     * freed by the last of the watchdog and those workers to let go of it
+     */
+    Stragglers*         make_stragglers         ();
+
+    // a worker was abandoned and will call stragglers_done when it exit
+    void                stragglers_add          (Stragglers* stragglers);
+
+    void                stragglers_done         (Stragglers* stragglers);
+
+    /**
+     * @brief
+     * wait at most timeout_ms for every abandoned worker to exit,
+     * return the number still running
+     */
+    int                 stragglers_wait         (Stragglers* stragglers,
+                                                 int timeout_ms);
+
+    // called once by the watchdog, the workers still running keep it alive
+    void                stragglers_release      (Stragglers* stragglers);
+} // namespace encoder
+
+#endif
@@ -61,6 +61,20 @@ namespace platf {
         int32 height;
         int32 pixel_pitch;
         int32 row_pitch;
+
+        /**
+         * @brief 
+         * set by capture when the slot brought no new content,
+         * data still hold the previous picture
+         */
+        bool unchanged;
+
+        /**
+         * @brief 
+         * steady clock time in ns the picture was presented,
+         * time of the slot when unchanged
+         */
+        int64 timestamp;
     }Image;
 
     typedef struct _HWDeviceClass DeviceClass;
@@ -120,6 +134,21 @@ namespace platf {
         int offset_x, offset_y;
         int env_width, env_height;
         int width, height;
+
+        /**
+         * @brief 
+         * capture slot of the image handed to the snapshot callback,
+         * slots skipped because the encoder was behind are counted in dropped.
+         * both are reported by the capture worker when it stop
+         */
+        int64 frame_index;
+        uint64 dropped;
+
+        /**
+         * @brief 
+         * longest wait in ns for the next image once the snapshot callback returned
+         */
+        int64 slot;
     };
 
     struct _DisplayClass {
@@ -133,6 +162,9 @@ namespace platf {
 
         Image*      (*alloc_img)        (Display* self);
 
+        void        (*free_img)         (Display* self,
+                                         Image* img);
+
         Device*     (*make_hwdevice)    (Display* self,
                                          PixelFormat pix_fmt);
         
@@ -147,6 +179,24 @@ namespace platf {
                                          platf::Image *img_base, 
                                          std::chrono::milliseconds timeout, 
                                          bool cursor_visible); 
+
+        /**
+         * @brief 
+         * Called after capture returned Capture::reinit,
+         * only the capture side is rebuilt, devices made by make_hwdevice stay valid.
+         * 
+         * Returns -1 on failure, 
+         *          1 if the output size or format changed (images and hwdevices must be recreated), 
+         *          0 otherwise
+         */
+        int         (*reinit)           (Display* self);
+
+        /**
+         * @brief 
+         * change the capture pace of a running capture loop
+         */
+        void        (*set_framerate)    (Display* self,
+                                         int framerate);
     };
 
 
@@ -175,11 +225,25 @@ namespace platf {
     Color*                  get_color     ();
 
 
+    /**
+     * @brief 
+     * get_display retried while the output is not ready,
+     * every call open its own duplication, the caller finalize it
+     */
     Display*                tryget_display(libav::HWDeviceType type, 
                                            char* display_name, 
                                            int framerate);
 
     PixelFormat             map_pix_fmt     (libav::PixelFormat fmt);
+
+    /**
+     * @brief 
+     * identity of the adapter and driver behind display,
+     * changes whenever the gpu or its driver is replaced
+     */
+    int                     adapter_fingerprint(Display* display,
+                                                char* out,
+                                                int size);
 } // namespace platf
 
 #endif //SUNSHINE_COMMON_H
@@ -80,6 +80,14 @@ namespace display{
     syncThreadDesktop();
 
     self->delay = std::chrono::nanoseconds { 1s } / framerate;
+    self->budget = ENCODER_CONFIG->latency_budget > 0 ? 
+                    std::chrono::nanoseconds { std::chrono::milliseconds { ENCODER_CONFIG->latency_budget } } : 
+                    self->delay;
+    self->base.frame_index = 1;
+    self->stride = 1;
+    self->idle_stride = ENCODER_CONFIG->idle_framerate > 0 ? MAX(framerate / ENCODER_CONFIG->idle_framerate, 1) : 1;
+    self->last_change = std::chrono::steady_clock::now();
+    self->base.slot = self->delay.count();
 
     // Get rectangle of full desktop for absolute mouse coordinates
     self->base.env_width  = GetSystemMetrics(SM_CXVIRTUALSCREEN);
@@ -178,6 +186,18 @@ namespace display{
       return -1;
     }
 
+    // helper::device_ctx_lock use the critical section of this device
+    {
+      ID3D11Multithread* multithread = NULL;
+      status = self->device_ctx->QueryInterface(__uuidof(ID3D11Multithread), (void **)&multithread);
+      if(FAILED(status)) {
+        LOG_ERROR("Failed to query ID3D11Multithread interface");
+        return -1;
+      }
+      multithread->SetMultithreadProtected(TRUE);
+      multithread->Release();
+    }
+
     DXGI_ADAPTER_DESC adapter_desc;
     self->adapter->GetDesc(&adapter_desc);
 
@@ -266,6 +286,21 @@ namespace display{
       }
     }
 
+    return display_base_duplicate(self);
+  }
+
+  /**
+   * @brief 
+   * (re)create the output duplication on the existing d3d11 device
+   * 
+   * @param self 
+   * @return int 
+   */
+  int
+  display_base_duplicate(DisplayBase* self)
+  {
+    HRESULT status;
+
     //FIXME: Duplicate output on RX580 in combination with DOOM (2016) --> BSOD
     //TODO: Use IDXGIOutput5 for improved performance
     {
@@ -287,6 +322,7 @@ namespace display{
 
       if(FAILED(status)) {
         LOG_ERROR("DuplicateOutput Failed");
+        output1->Release();
         return -1;
       }
       output1->Release();
@@ -299,6 +335,83 @@ namespace display{
     return 0;
   }
 
+  /**
+   * @brief 
+   * change the capture pace of a running capture loop,
+   * slots restart at full rate and the idle stride follow the new framerate
+   */
+  void
+  display_base_set_framerate(platf::Display* disp,
+                             int framerate)
+  {
+    DisplayBase* self = (DisplayBase*)disp;
+    if(framerate <= 0)
+      return;
+
+    // read by the capture loop before each frame
+    self->delay = std::chrono::nanoseconds { 1s } / framerate;
+    if(ENCODER_CONFIG->latency_budget <= 0)
+      self->budget = self->delay;
+
+    self->stride = 1;
+    self->idle_stride = ENCODER_CONFIG->idle_framerate > 0 ? MAX(framerate / ENCODER_CONFIG->idle_framerate, 1) : 1;
+    self->last_change = std::chrono::steady_clock::now();
+  }
+
+  void
+  display_base_govern(DisplayBase* self,
+                      bool changed)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if(changed) {
+      // first change is captured as soon as it arrive, 
+      // the slot then shrink back to the full rate in a few steps
+      self->last_change = now;
+      self->stride = MAX(self->stride / 2, 1);
+      return;
+    }
+
+    if(now - self->last_change > std::chrono::milliseconds { ENCODER_CONFIG->idle_timeout })
+      self->stride = self->idle_stride;
+  }
+
+  /**
+   * @brief 
+   * recreate the duplication after access lost (mode change, desktop switch, ...)
+   * while keeping the d3d11 device, so that every hwdevice and codec built on it stay valid
+   * 
+   * @param self 
+   * @return int -1 on failure, 1 when output size or format changed, 0 otherwise
+   */
+  int
+  display_base_reinit(DisplayBase* self)
+  {
+    DUPLICATION_CLASS->finalize(&self->dup);
+    if(self->dup.dup) {
+      self->dup.dup->Release();
+      self->dup.dup = NULL;
+    }
+
+    // Ensure we can duplicate the current display
+    syncThreadDesktop();
+
+    int width  = self->base.width;
+    int height = self->base.height;
+    DXGI_FORMAT format = self->format;
+
+    DXGI_OUTPUT_DESC desc;
+    self->output->GetDesc(&desc);
+    self->base.width  = desc.DesktopCoordinates.right  - desc.DesktopCoordinates.left;
+    self->base.height = desc.DesktopCoordinates.bottom - desc.DesktopCoordinates.top;
+
+    if(display_base_duplicate(self))
+      return -1;
+
+    return (width  != self->base.width || 
+            height != self->base.height || 
+            format != self->format) ? 1 : 0;
+  }
+
   const char *format_str[] = {
     "DXGI_FORMAT_UNKNOWN",
     "DXGI_FORMAT_R32G32B32A32_TYPELESS",
@@ -33,6 +33,22 @@ namespace display {
         duplication::Duplication dup;
 
         std::chrono::nanoseconds delay;
+
+        /**
+         * @brief 
+         * how late a capture slot may start before the slots it skipped count as dropped,
+         * the grid itself is restarted as soon as a slot is more than delay late
+         */
+        std::chrono::nanoseconds budget;
+
+        /**
+         * @brief 
+         * capture slot length in frame intervals, above 1 while the screen is idle,
+         * idle_stride is the length used once idle_timeout passed without any change
+         */
+        int stride;
+        int idle_stride;
+        std::chrono::steady_clock::time_point last_change;
         DXGI_FORMAT format;
         D3D_FEATURE_LEVEL feature_level;
     }DisplayBase;
@@ -51,6 +67,21 @@ namespace display {
                                                  int framerate, 
                                                  char* display_name);
 
+    int             display_base_duplicate      (DisplayBase* self);
+
+    int             display_base_reinit         (DisplayBase* self);
+
+    void            display_base_set_framerate  (platf::Display* self,
+                                                 int framerate);
+
+    /**
+     * @brief 
+     * called after every capture slot, 
+     * lengthen the slots of an idle screen and shorten them again once it changes
+     */
+    void            display_base_govern         (DisplayBase* self,
+                                                 bool changed);
+
 } // namespace platf::dxgi
 
 #endif
@@ -45,6 +45,9 @@ namespace duplication
         return platf::Capture::timeout;
       case WAIT_ABANDONED:
       case DXGI_ERROR_ACCESS_LOST:
+      case DXGI_ERROR_ACCESS_DENIED:
+        // duplication must be recreated, the device itself is still usable
+        return platf::Capture::reinit;
       default:
         LOG_ERROR("Couldn't acquire next frame");
         return platf::Capture::error;
@@ -68,6 +71,9 @@ namespace duplication
           return platf::Capture::timeout;
         case WAIT_ABANDONED:
         case DXGI_ERROR_ACCESS_LOST:
+        case DXGI_ERROR_ACCESS_DENIED:
+          dup->has_frame = false;
+          return platf::Capture::reinit;
         default:
           LOG_ERROR("Couldn't release frame");
           return platf::Capture::error;
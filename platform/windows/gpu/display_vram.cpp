@@ -28,8 +28,63 @@ extern "C" {
 
 using namespace std::literals;
 
+// windows 10 1803 and later, older headers do not define it
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// part of the slot wait that is spun, it cover the wake up jitter of the timer
+#define SLOT_SPIN 1ms
+
 
 namespace gpu {
+    static int64
+    steady_now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief 
+     * LastPresentTime is a QueryPerformanceCounter value, 
+     * converted with the same split as steady_clock so that both clocks agree
+     */
+    static int64
+    present_time_ns(LARGE_INTEGER present)
+    {
+        static LARGE_INTEGER frequency = {0};
+        if(!frequency.QuadPart)
+            QueryPerformanceFrequency(&frequency);
+
+        int64 whole = present.QuadPart / frequency.QuadPart;
+        int64 part  = present.QuadPart % frequency.QuadPart;
+        return whole * 1000000000LL + part * 1000000000LL / frequency.QuadPart;
+    }
+
+    /**
+     * @brief 
+     * sleep on timer until SLOT_SPIN before slot, then spin the rest,
+     * the whole wait is spun when no high resolution timer is available
+     */
+    static void
+    wait_slot(HANDLE timer,
+              std::chrono::steady_clock::time_point slot)
+    {
+      auto wake = slot - SLOT_SPIN;
+      auto now = std::chrono::steady_clock::now();
+      if(timer && wake > now) {
+        // relative due time in 100ns units
+        LARGE_INTEGER due;
+        due.QuadPart = -(std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now).count() / 100);
+        if(SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+          WaitForSingleObject(timer, INFINITE);
+      }
+
+      while(std::chrono::steady_clock::now() < slot)
+        YieldProcessor();
+    }
+
     platf::Capture    display_vram_snapshot   (platf::Display* disp,
                                                platf::Image *img_base, 
                                                std::chrono::milliseconds timeout, 
@@ -50,35 +105,76 @@ namespace gpu {
                         encoder::EncodeThreadContext* thread_ctx,
                         bool cursor) 
     {
-        platf::Capture status;
+        platf::Capture status = platf::Capture::ok;
         DisplayVram* self = (DisplayVram*) disp; 
+
+        // the default timer resolution is far coarser than a frame interval
+        HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+        // capture run on a fixed grid of slots, one every delay
         auto next_frame = std::chrono::steady_clock::now();
+        bool encoded = FALSE;
         while(img) {
+          wait_slot(timer, next_frame);
           auto now = std::chrono::steady_clock::now();
-          while(next_frame > now) {
-            now = std::chrono::steady_clock::now();
+
+          // the grid never catch up, a capture more than one interval late restart it from now.
+          // index keep counting so that pts stay continuous with time
+          auto late = now - next_frame;
+          if(late > self->base.delay) {
+            int64 missed = late / self->base.delay;
+            next_frame += missed * self->base.delay;
+            disp->frame_index += missed;
+
+            // the encoder was behind, not the screen idle
+            if(encoded && late > self->base.budget)
+              disp->dropped += missed;
           }
 
-          next_frame = now + self->base.delay;
-          status = display_vram_snapshot((platf::Display*)self,img,1000ms,cursor);
-          switch(status) {
-            case platf::Capture::error:
-              return status;
-            case platf::Capture::timeout:
-              std::this_thread::sleep_for(1ms);
-              continue;
-            default:
-              break;
+          // an idle screen use slots of several frame intervals
+          int64 stride = self->base.stride;
+          auto slot_start = next_frame;
+          next_frame += stride * self->base.delay;
+          encoded = FALSE;
+
+          // wait at most one slot, the encoder decide what to do with an idle slot
+          auto timeout = MAX(std::chrono::duration_cast<std::chrono::milliseconds>(stride * self->base.delay), 1ms);
+          status = display_vram_snapshot((platf::Display*)self,img,timeout,cursor);
+          if(status == platf::Capture::error || status == platf::Capture::reinit)
+            break;
+
+          if(status == platf::Capture::timeout) {
+            // a repeat stand for the picture still on screen now
+            img->unchanged = TRUE;
+            img->timestamp = steady_now_ns();
+          } else {
+            img->unchanged = FALSE;
           }
-          status = snapshot_cb(&img,data,thread_ctx);
-          switch(status) {
-            case platf::Capture::ok:
-              break;
-            default:
-              return status;
+
+          // a change in the middle of a long slot is taken right away,
+          // the grid restart on the frame interval that follow it
+          if(!img->unchanged && stride > 1) {
+            int64 skipped = MIN((std::chrono::steady_clock::now() - slot_start) / self->base.delay, stride - 1);
+            disp->frame_index += skipped;
+            next_frame = slot_start + (skipped + 1) * self->base.delay;
+            stride = 1;
           }
+
+          // next slot is chosen before the callback so that the encoder know how long the wait can be
+          display::display_base_govern(&self->base, !img->unchanged);
+          disp->slot = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        (next_frame - std::chrono::steady_clock::now()) + self->base.stride * self->base.delay).count();
+
+          status = snapshot_cb(&img,data,thread_ctx);
+          disp->frame_index += stride;
+          encoded = !img->unchanged;
+          if(status != platf::Capture::ok)
+            break;
         }
-        return platf::Capture::ok;
+
+        if(timer)
+          CloseHandle(timer);
+        return status;
     }
 
     platf::Capture 
@@ -109,6 +205,9 @@ namespace gpu {
         return platf::Capture::timeout;
       }
 
+      // cursor is only part of the picture while it is drawn
+      const bool cursor_was_visible = self->cursor.visible;
+
       // todo
       if(frame_info.PointerShapeBufferSize > 0) {
         DXGI_OUTDUPL_POINTER_SHAPE_INFO shape_info {};
@@ -186,6 +285,16 @@ namespace gpu {
                                   frame_info.PointerPosition.Visible && cursor_visible);
       }
 
+      // a mouse move with the cursor hidden leave the picture untouched
+      if(!frame_update_flag && !self->cursor.visible && !cursor_was_visible) {
+        return platf::Capture::timeout;
+      }
+
+      // mouse only update has no present time, it is drawn now
+      img_base->timestamp = frame_update_flag && frame_info.LastPresentTime.QuadPart ?
+                            present_time_ns(frame_info.LastPresentTime) :
+                            steady_now_ns();
+
       if(frame_update_flag) {
         // src.reset();
         status = res->QueryInterface(IID_ID3D11Texture2D, (void **)&self->src);
@@ -196,6 +305,8 @@ namespace gpu {
         }
       }
 
+      // the encoder convert on the same device from another thread
+      helper::device_ctx_lock(self->base.device_ctx);
       self->base.device_ctx->CopyResource(img->texture, self->src);
       if(self->cursor.visible) {
         D3D11_VIEWPORT view {
@@ -215,6 +326,7 @@ namespace gpu {
         self->base.device_ctx->Draw(3, 0);
         self->base.device_ctx->OMSetBlendState(self->blend_disable, nullptr, 0xFFFFFFFFu);
       }
+      helper::device_ctx_unlock(self->base.device_ctx);
 
       return platf::Capture::ok;
     }
@@ -287,6 +399,18 @@ namespace gpu {
       return (platf::Display*)self;
     }
 
+    int
+    display_vram_reinit(platf::Display* disp)
+    {
+        DisplayVram* self = (DisplayVram*)disp;
+        if(self->src) {
+          self->src->Release();
+          self->src = NULL;
+        }
+
+        return display::display_base_reinit(&self->base);
+    }
+
     void
     display_vram_finalize(void* self)
     {
@@ -370,6 +494,7 @@ namespace gpu {
     {
       DisplayVram* disp= (DisplayVram*) platf_disp;
       gpu::ImageGpu* img = (gpu::ImageGpu*)malloc(sizeof(gpu::ImageGpu));
+      memset(img,0,sizeof(gpu::ImageGpu));
       platf::Image* img_base = (platf::Image*)img;
 
       display::DisplayBase* display_base = (display::DisplayBase*)disp;
@@ -416,6 +541,23 @@ namespace gpu {
       return (platf::Image*)img;
     }
 
+    void
+    display_vram_free_img(platf::Display* disp,
+                          platf::Image* img_base) 
+    {
+      gpu::ImageGpu* img = (gpu::ImageGpu*)img_base;
+      if(!img)
+        return;
+
+      if(img->input_res)
+        img->input_res->Release();
+      if(img->scene_rt)
+        img->scene_rt->Release();
+      if(img->texture)
+        img->texture->Release();
+      free(img);
+    }
+
     /**
      * @brief 
      * 
@@ -495,6 +637,9 @@ namespace gpu {
         klass.base.init          = display_vram_init;
         klass.base.finalize      = display_vram_finalize;
         klass.base.alloc_img     = display_vram_alloc_img;
+        klass.base.free_img      = display_vram_free_img;
+        klass.base.reinit        = display_vram_reinit;
+        klass.base.set_framerate = display::display_base_set_framerate;
         klass.base.dummy_img     = display_vram_dummy_img;
         klass.base.make_hwdevice = display_vram_make_hwdevice;
         klass.base.snapshot      = display_vram_snapshot;
@@ -237,9 +237,11 @@ namespace gpu
         return NULL;
       }
 
+      helper::device_ctx_lock(self->device_ctx);
       self->device_ctx->IASetInputLayout(self->input_layout);
       self->device_ctx->PSSetConstantBuffers(0, 1, &self->color_matrix);
       self->device_ctx->VSSetConstantBuffers(0, 1, &self->info_scene);
+      helper::device_ctx_unlock(self->device_ctx);
 
       return (platf::Device*)self;
     }
@@ -283,7 +285,9 @@ namespace gpu
         return;
       }
 
+      helper::device_ctx_lock(self->device_ctx);
       self->device_ctx->PSSetConstantBuffers(0, 1, &color_matrix);
+      helper::device_ctx_unlock(self->device_ctx);
       self->color_matrix = color_matrix;
     }
 
@@ -300,6 +304,7 @@ namespace gpu
         GpuDevice* self = (GpuDevice*)dev;
         ImageGpu* img = (ImageGpu*)img_base;
 
+        helper::device_ctx_lock(self->device_ctx);
         self->device_ctx->IASetInputLayout(self->input_layout);
 
         d3d11_device_init_view_port(self,self->img.base.width, self->img.base.height);
@@ -328,6 +333,7 @@ namespace gpu
         self->device_ctx->PSSetShaderResources(0, 1, &img->input_res);
         self->device_ctx->Draw(3, 0);
         self->device_ctx->Flush();
+        helper::device_ctx_unlock(self->device_ctx);
 
         return 0;
     }
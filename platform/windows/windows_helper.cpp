@@ -13,6 +13,7 @@
 #include <display_vram.h>
 #include <sunshine_util.h>
 
+#include <d3d11_4.h>
 #include <d3dcompiler.h>
 #include <directxmath.h>
 
@@ -24,6 +25,7 @@ extern "C" {
 #include <platform_common.h>
 #include <gpu_hw_device.h>
 #include <thread>
+#include <mutex>
 
 
 
@@ -252,6 +254,40 @@ namespace helper
     } 
 
 
+    /**
+     * @brief 
+     * the multithread interface is owned by the context, no reference is kept
+     */
+    static ID3D11Multithread*
+    device_multithread(void* ctx)
+    {
+        ID3D11Multithread* multithread = NULL;
+        HRESULT status = ((d3d11::DeviceContext)ctx)->QueryInterface(__uuidof(ID3D11Multithread), (void **)&multithread);
+        if(FAILED(status)) {
+            LOG_ERROR("Failed to query ID3D11Multithread interface");
+            return NULL;
+        }
+
+        multithread->Release();
+        return multithread;
+    }
+
+    void
+    device_ctx_lock(void* ctx)
+    {
+        ID3D11Multithread* multithread = device_multithread(ctx);
+        if(multithread)
+            multithread->Enter();
+    }
+
+    void
+    device_ctx_unlock(void* ctx)
+    {
+        ID3D11Multithread* multithread = device_multithread(ctx);
+        if(multithread)
+            multithread->Leave();
+    }
+
     HLSL*
     init_hlsl() 
     {
@@ -311,8 +347,10 @@ namespace platf {
         if(hwdevice_type == MemoryType::dxgi) 
             return ((platf::DisplayClass*)DISPLAY_VRAM_CLASS)->init(framerate, display_name);
         
+        // system memory encoder download frames after the gpu conversion,
+        // so they capture through the same display
         if(hwdevice_type == MemoryType::system)
-            // TODO display ram
+            return ((platf::DisplayClass*)DISPLAY_VRAM_CLASS)->init(framerate, display_name);
         
         return NULL;
     }
@@ -373,16 +411,40 @@ namespace platf {
       return display_names;
     }
 
+    int
+    adapter_fingerprint(Display* display,
+                        char* out,
+                        int size)
+    {
+        display::DisplayBase* base = (display::DisplayBase*)display;
+        if(!base || !base->adapter)
+            return -1;
+
+        DXGI_ADAPTER_DESC1 desc;
+        if(FAILED(base->adapter->GetDesc1(&desc)))
+            return -1;
+
+        // user mode driver version
+        LARGE_INTEGER umd = {0};
+        base->adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umd);
+
+        snprintf(out, size, "%04x:%04x:%08x:%02x:%llu",
+                 desc.VendorId, 
+                 desc.DeviceId, 
+                 desc.SubSysId, 
+                 desc.Revision,
+                 (unsigned long long)umd.QuadPart);
+        return 0;
+    }
+
     Display*
     tryget_display(libav::HWDeviceType type, 
                   char* display_name, 
                   int framerate) 
     {
-        static Display* disp = NULL;
-        // We try this twice, in case we still get an error on reinitialization
+        Display* disp = NULL;
+        // We try this several times, in case we still get an error on reinitialization
         for(int x = 0; x < DISPLAY_RETRY; ++x) {
-            if (disp)
-                break;
             disp = get_display(helper::map_dev_type(type), display_name, framerate);
             if (disp)
                 break;
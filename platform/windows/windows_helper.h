@@ -58,6 +58,19 @@ namespace helper
      */
     platf::MemoryType       map_dev_type        (libav::HWDeviceType type) ;
 
+    /**
+     * @brief 
+     * immediate context of a d3d11 device is not thread safe,
+     * the capture, our hwdevices and libavcodec (AVD3D11VADeviceContext::lock) 
+     * go through the critical section of the device, devices never wait for each other.
+     * recursive on the same thread
+     * 
+     * @param ctx immediate context (d3d11::DeviceContext) of the device
+     */
+    void                    device_ctx_lock     (void* ctx);
+
+    void                    device_ctx_unlock   (void* ctx);
+
     typedef struct _HLSL
     {  
       d3d::Blob convert_UV_vs_hlsl;
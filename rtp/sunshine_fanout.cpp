@@ -0,0 +1,466 @@
+/**
+ * @file sunshine_fanout.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-31
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <sunshine_fanout.h>
+#include <sunshine_rtp.h>
+#include <sunshine_util.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+#include <string.h>
+#include <stdio.h>
+
+using namespace std::literals;
+
+namespace rtp
+{
+    struct _Viewer {
+        Fanout* fanout;
+
+        char address[64];
+        int port;
+        int bitrate;
+
+        std::mutex lock;
+        std::condition_variable cond;
+
+        /**
+         * @brief 
+         * ring of packet reference waiting to be sent
+         */
+        util::Buffer* queue[VIEWER_MAX_QUEUE];
+        int head;
+        int count;
+
+        bool waiting_keyframe;
+        bool closed;
+
+        /**
+         * @brief 
+         * only touched by the sender thread
+         */
+        RtpContext* streams[RTP_MAX_STREAMS];
+        std::chrono::steady_clock::time_point next_send;
+
+        uint64 sent;
+        uint64 dropped;
+
+        std::thread thread;
+    };
+
+    struct _Fanout {
+        RtpOutput* output;
+        util::QueueArray* source;
+        util::Broadcaster* shutdown_event;
+
+        KeyframeRequest request;
+        pointer data;
+
+        std::mutex lock;
+        Viewer* viewers[FANOUT_MAX_VIEWERS];
+        int count;
+        bool closed;
+
+        /**
+         * @brief 
+         * only touched by the dispatch thread
+         */
+        RtpStream streams[RTP_MAX_STREAMS];
+
+        std::thread thread;
+    };
+
+
+    static void
+    request_keyframe(Fanout* fanout)
+    {
+        if(fanout->request)
+            fanout->request(fanout->data);
+    }
+
+    /**
+     * @brief 
+     * viewer lock must be held
+     */
+    static void
+    viewer_flush(Viewer* viewer)
+    {
+        while(viewer->count) {
+            BUFFER_CLASS->unref(viewer->queue[viewer->head]);
+            viewer->head = (viewer->head + 1) % VIEWER_MAX_QUEUE;
+            viewer->count--;
+            viewer->dropped++;
+        }
+    }
+
+    static void
+    viewer_push(Viewer* viewer,
+                util::Buffer* buf)
+    {
+        bool resync = FALSE;
+        {
+            std::lock_guard<std::mutex> guard(viewer->lock);
+
+            // slow viewer must not hold back the others,
+            // drop what it has not sent and restart it on a keyframe
+            if(viewer->count == VIEWER_MAX_QUEUE) {
+                viewer_flush(viewer);
+                viewer->waiting_keyframe = TRUE;
+                resync = TRUE;
+            }
+
+            BUFFER_CLASS->ref(buf,NULL);
+            viewer->queue[(viewer->head + viewer->count) % VIEWER_MAX_QUEUE] = buf;
+            viewer->count++;
+        }
+        viewer->cond.notify_one();
+
+        if(resync) {
+            LOG_WARNING("viewer fell behind, waiting for keyframe");
+            request_keyframe(viewer->fanout);
+        }
+    }
+
+    static void
+    viewer_pace(Viewer* viewer,
+                int size)
+    {
+        if(viewer->bitrate <= 0)
+            return;
+
+        // follow the encoder when the client change the bitrate while streaming
+        int bitrate = output_bitrate(viewer->fanout->output);
+        if(bitrate <= 0)
+            bitrate = viewer->bitrate;
+
+        // no credit is kept from idle time, so a keyframe is never sent as a burst
+        auto now = std::chrono::steady_clock::now();
+        if(viewer->next_send > now)
+            std::this_thread::sleep_until(viewer->next_send);
+        else
+            viewer->next_send = now;
+
+        int64 bytes_per_sec = (int64)bitrate * 1000 / 8 * VIEWER_PACING_PERCENT / 100;
+        viewer->next_send += std::chrono::nanoseconds { (int64)size * 1000000000LL / bytes_per_sec };
+    }
+
+    /**
+     * @brief 
+     * return FALSE when the viewer must resync on a keyframe
+     */
+    static bool
+    viewer_send(Viewer* viewer,
+                RtpFrame* frame,
+                libav::Packet* packet)
+    {
+        int index = packet->stream_index;
+        RtpContext** stream = &viewer->streams[index];
+
+        // encode session was recreated, codec parameters are different
+        if(*stream && (*stream)->generation != frame->generation) {
+            close_rtp_context(*stream);
+            *stream = NULL;
+        }
+
+        if(!*stream) {
+            if(!(packet->flags & AV_PKT_FLAG_KEY))
+                return FALSE;
+
+            *stream = open_rtp_context(viewer->fanout->output, 
+                                       frame, 
+                                       viewer->address, 
+                                       viewer->port + 2 * index);
+            if(!*stream)
+                return FALSE;
+        }
+
+        viewer_pace(viewer, packet->size);
+        if(write_rtp_packet(*stream, frame)) {
+            close_rtp_context(*stream);
+            *stream = NULL;
+            return FALSE;
+        }
+
+        viewer->sent++;
+        return TRUE;
+    }
+
+    static void
+    viewer_thread(Viewer* viewer)
+    {
+        while(TRUE) {
+            util::Buffer* buf;
+            RtpFrame* frame;
+            libav::Packet* packet = NULL;
+            {
+                std::unique_lock<std::mutex> lock(viewer->lock);
+                viewer->cond.wait(lock, [&] { return viewer->closed || viewer->count; });
+                if(viewer->closed)
+                    return;
+
+                buf = viewer->queue[viewer->head];
+                viewer->head = (viewer->head + 1) % VIEWER_MAX_QUEUE;
+                viewer->count--;
+
+                int size;
+                frame = (RtpFrame*)BUFFER_CLASS->ref(buf,&size);
+                if(size != sizeof(RtpFrame))
+                    LOG_ERROR("wrong datatype");
+                else {
+                    // frame hold the packet until it is unref
+                    packet = (libav::Packet*)BUFFER_CLASS->ref(frame->packet,NULL);
+                    BUFFER_CLASS->unref(frame->packet);
+                }
+
+                // late joiner start on the first keyframe of the first stream
+                if(packet && viewer->waiting_keyframe) {
+                    if(packet->stream_index == 0 && (packet->flags & AV_PKT_FLAG_KEY))
+                        viewer->waiting_keyframe = FALSE;
+                    else
+                        packet = NULL;
+                }
+            }
+
+            bool resync = packet && !viewer_send(viewer, frame, packet);
+            BUFFER_CLASS->unref(buf);
+            BUFFER_CLASS->unref(buf);
+
+            if(resync) {
+                {
+                    std::lock_guard<std::mutex> guard(viewer->lock);
+                    viewer->waiting_keyframe = TRUE;
+                }
+                request_keyframe(viewer->fanout);
+            }
+        }
+    }
+
+    static void
+    viewer_finalize(Viewer* viewer)
+    {
+        {
+            std::lock_guard<std::mutex> guard(viewer->lock);
+            viewer->closed = TRUE;
+        }
+        viewer->cond.notify_all();
+        if(viewer->thread.joinable())
+            viewer->thread.join();
+
+        viewer_flush(viewer);
+        for(int i = 0; i < RTP_MAX_STREAMS; i++) 
+            close_rtp_context(viewer->streams[i]);
+
+        char log[128];
+        snprintf(log, sizeof(log), "viewer %s:%d left, sent %llu dropped %llu",
+                 viewer->address, viewer->port,
+                 (unsigned long long)viewer->sent,
+                 (unsigned long long)viewer->dropped);
+        LOG_INFO(log);
+
+        viewer->thread.~thread();
+        viewer->lock.~mutex();
+        viewer->cond.~condition_variable();
+        free(viewer);
+    }
+
+    static void
+    dispatch_thread(Fanout* fanout)
+    {
+        util::QueueArray* packets = fanout->source;
+
+        while(!IS_INVOKED(fanout->shutdown_event)) {
+            {
+                std::lock_guard<std::mutex> guard(fanout->lock);
+                if(fanout->closed)
+                    break;
+            }
+
+            if(!QUEUE_ARRAY_CLASS->peek(packets)) {
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+
+            int size;
+            util::Buffer* buf;
+            QUEUE_ARRAY_CLASS->pop(packets,&buf,&size);
+            if(size != sizeof(libav::Packet)) {
+                LOG_ERROR("wrong datatype");
+                BUFFER_CLASS->unref(buf);
+                continue;
+            }
+
+            libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(buf,NULL);
+            int index = packet->stream_index;
+            BUFFER_CLASS->unref(buf);
+
+            bool idle;
+            {
+                std::lock_guard<std::mutex> guard(fanout->lock);
+                idle = !fanout->count;
+            }
+
+            if(idle || index < 0 || index >= RTP_MAX_STREAMS) {
+                BUFFER_CLASS->unref(buf);
+                continue;
+            }
+
+            // packet is encoded and packetized once, viewers only take a reference
+            util::Buffer* frame = make_rtp_frame(fanout->output, 
+                                                 &fanout->streams[index], 
+                                                 index, 
+                                                 buf);
+            BUFFER_CLASS->unref(buf);
+            if(!frame) {
+                LOG_WARNING("failed to packetize frame, waiting for keyframe");
+                {
+                    std::lock_guard<std::mutex> guard(fanout->lock);
+                    for(int i = 0; i < fanout->count; i++) {
+                        std::lock_guard<std::mutex> viewer_guard(fanout->viewers[i]->lock);
+                        fanout->viewers[i]->waiting_keyframe = TRUE;
+                    }
+                }
+                request_keyframe(fanout);
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(fanout->lock);
+                for(int i = 0; i < fanout->count; i++)
+                    viewer_push(fanout->viewers[i], frame);
+            }
+            BUFFER_CLASS->unref(frame);
+        }
+
+        for(int i = 0; i < RTP_MAX_STREAMS; i++)
+            close_rtp_stream(&fanout->streams[i]);
+    }
+
+    Fanout*
+    fanout_init(RtpOutput* output,
+                util::Broadcaster* shutdown_event,
+                KeyframeRequest request,
+                pointer data)
+    {
+        Fanout* fanout = (Fanout*)malloc(sizeof(Fanout));
+        memset((pointer)fanout,0,sizeof(Fanout));
+        new (&fanout->lock) std::mutex();
+
+        fanout->output         = output;
+        fanout->source         = rtp_output_queue(output);
+        fanout->shutdown_event = shutdown_event;
+        fanout->request        = request;
+        fanout->data           = data;
+
+        new (&fanout->thread) std::thread(dispatch_thread, fanout);
+        return fanout;
+    }
+
+    Viewer*
+    fanout_join(Fanout* fanout,
+                char* address,
+                int port,
+                int bitrate)
+    {
+        Viewer* viewer = (Viewer*)malloc(sizeof(Viewer));
+        memset((pointer)viewer,0,sizeof(Viewer));
+        new (&viewer->lock) std::mutex();
+        new (&viewer->cond) std::condition_variable();
+        new (&viewer->next_send) std::chrono::steady_clock::time_point();
+
+        viewer->fanout  = fanout;
+        viewer->port    = port;
+        viewer->bitrate = bitrate;
+        snprintf(viewer->address, sizeof(viewer->address), "%s", address);
+
+        // stream can only be decoded from a keyframe
+        viewer->waiting_keyframe = TRUE;
+
+        {
+            std::lock_guard<std::mutex> guard(fanout->lock);
+            if(fanout->count == FANOUT_MAX_VIEWERS) {
+                LOG_ERROR("too many viewers");
+                viewer->lock.~mutex();
+                viewer->cond.~condition_variable();
+                free(viewer);
+                return NULL;
+            }
+
+            new (&viewer->thread) std::thread(viewer_thread, viewer);
+            fanout->viewers[fanout->count++] = viewer;
+        }
+
+        request_keyframe(fanout);
+        return viewer;
+    }
+
+    void
+    fanout_leave(Fanout* fanout,
+                 Viewer* viewer)
+    {
+        {
+            std::lock_guard<std::mutex> guard(fanout->lock);
+            for(int i = 0; i < fanout->count; i++) {
+                if(fanout->viewers[i] != viewer)
+                    continue;
+
+                fanout->viewers[i] = fanout->viewers[--fanout->count];
+                fanout->viewers[fanout->count] = NULL;
+                break;
+            }
+        }
+
+        viewer_finalize(viewer);
+    }
+
+    int
+    fanout_count(Fanout* fanout)
+    {
+        std::lock_guard<std::mutex> guard(fanout->lock);
+        return fanout->count;
+    }
+
+    void
+    fanout_finalize(Fanout* fanout)
+    {
+        {
+            std::lock_guard<std::mutex> guard(fanout->lock);
+            fanout->closed = TRUE;
+        }
+        if(fanout->thread.joinable())
+            fanout->thread.join();
+
+        while(fanout->count)
+            fanout_leave(fanout, fanout->viewers[0]);
+
+        fanout->thread.~thread();
+        fanout->lock.~mutex();
+        free(fanout);
+    }
+
+    FanoutClass*
+    fanout_class_init()
+    {
+        static bool initialized = false;
+        static FanoutClass klass = {0};
+        if (initialized)
+            return &klass;
+
+        klass.init     = fanout_init;
+        klass.join     = fanout_join;
+        klass.leave    = fanout_leave;
+        klass.count    = fanout_count;
+        klass.finalize = fanout_finalize;
+        initialized = true;
+        return &klass;
+    }
+} // namespace rtp
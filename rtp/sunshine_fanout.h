@@ -0,0 +1,77 @@
+/**
+ * @file sunshine_fanout.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-31
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __SUNSHINE_FANOUT_H__
+#define __SUNSHINE_FANOUT_H__
+
+#include <sunshine_util.h>
+#include <sunshine_rtp.h>
+
+#define FANOUT_CLASS            rtp::fanout_class_init()
+
+#define FANOUT_MAX_VIEWERS      32
+
+// packets a viewer may lag behind before it is resynchronized on a keyframe
+#define VIEWER_MAX_QUEUE        256
+
+// viewers are paced at this percentage of their bitrate
+#define VIEWER_PACING_PERCENT   150
+
+namespace rtp
+{
+    typedef struct _Fanout Fanout;
+
+    typedef struct _Viewer Viewer;
+
+    /**
+     * @brief 
+     * one encoded rtp output delivered to many viewers.
+     * 
+     * source --> dispatch thread --> viewer queue --> viewer sender --> rtp
+     *                            |-> viewer queue --> viewer sender --> rtp
+     * 
+     * the dispatch thread packetize every packet once into a refcounted RtpFrame,
+     * every viewer only hold a reference.
+     * each viewer own its ssrc, sequence number and pacing, 
+     * only its rtp headers are written per viewer,
+     * a viewer that join or fall behind wait for the next keyframe
+     */
+    typedef struct _FanoutClass {
+        Fanout*     (*init)         (RtpOutput* output,
+                                     util::Broadcaster* shutdown_event,
+                                     KeyframeRequest request,
+                                     pointer data);
+
+        /**
+         * @brief 
+         * bitrate in kbps, used for pacing until the encoder publish its own on the output, 
+         * 0 disable pacing
+         */
+        Viewer*     (*join)         (Fanout* fanout,
+                                     char* address,
+                                     int port,
+                                     int bitrate);
+
+        void        (*leave)        (Fanout* fanout,
+                                     Viewer* viewer);
+
+        int         (*count)        (Fanout* fanout);
+
+        /**
+         * @brief 
+         * stop dispatch and every viewer
+         */
+        void        (*finalize)     (Fanout* fanout);
+    } FanoutClass;
+
+    FanoutClass*    fanout_class_init       ();
+} // namespace rtp
+
+#endif
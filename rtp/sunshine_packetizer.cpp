@@ -0,0 +1,587 @@
+/**
+ * @file sunshine_packetizer.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_packetizer.h>
+#include <sunshine_util.h>
+
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+
+// rfc 6184 payload structures
+#define H264_STAP_A             24
+#define H264_FU_A               28
+
+// rfc 7798 payload structures
+#define HEVC_AP                 48
+#define HEVC_FU                 49
+
+// hevc nal unit types
+#define HEVC_IRAP_FIRST         16
+#define HEVC_IRAP_LAST          23
+#define HEVC_VPS                32
+#define HEVC_SPS                33
+#define HEVC_PPS                34
+#define HEVC_AUD                35
+
+// packet descriptors per pool block, a block hold the usual P-frame
+#define PACKETIZER_BLOCK_PACKETS 64
+
+namespace rtp
+{
+    typedef struct _Nal {
+        byte* data;
+        int size;
+    }Nal;
+
+    struct _Packetizer {
+        libav::CodecID codec;
+        int mtu;
+
+        /**
+         * @brief
+         * nal unit header size, 1 for H.264 and 2 for HEVC
+         */
+        int header;
+
+        /**
+         * @brief
+         * batch and its packet descriptors share one block
+         */
+        util::BufferPool* pool;
+
+        /**
+         * @brief
+         * nal units of the access unit being packetized
+         */
+        Nal* nals;
+        int nal_count;
+        int nal_capacity;
+
+        /**
+         * @brief
+         * hevc VPS/SPS/PPS of the stream extradata,
+         * sent before keyframes that do not carry them.
+         * batch carrying them keep a reference on extradata
+         */
+        util::Buffer* extradata;
+        Nal* parameter_sets;
+        int parameter_count;
+    };
+
+    static void
+    add_nal(Packetizer* packetizer,
+            byte* data,
+            int size)
+    {
+        // nal never end with a zero byte, those belong to the next 4 bytes start code
+        while(size && !data[size - 1])
+            size--;
+        if(!size)
+            return;
+
+        if(packetizer->nal_count == packetizer->nal_capacity) {
+            packetizer->nal_capacity = MAX(packetizer->nal_capacity * 2, 16);
+            packetizer->nals = (Nal*)realloc(packetizer->nals, packetizer->nal_capacity * sizeof(Nal));
+        }
+
+        packetizer->nals[packetizer->nal_count].data = data;
+        packetizer->nals[packetizer->nal_count].size = size;
+        packetizer->nal_count++;
+    }
+
+    /**
+     * @brief
+     * split an annex-b byte stream on its start codes,
+     * nal units are appended to the packetizer list
+     */
+    static int
+    find_nals(Packetizer* packetizer,
+              byte* data,
+              int size)
+    {
+        int start = -1;
+        int i = 0;
+        while(i + 3 <= size) {
+            // no start code can begin at i, i+1 or i+2
+            if(data[i + 2] > 1) {
+                i += 3;
+                continue;
+            }
+
+            if(data[i] || data[i + 1] || data[i + 2] != 1) {
+                i++;
+                continue;
+            }
+
+            if(start >= 0)
+                add_nal(packetizer, data + start, i - start);
+
+            i += 3;
+            start = i;
+        }
+
+        if(start >= 0 && start < size)
+            add_nal(packetizer, data + start, size - start);
+
+        return packetizer->nal_count;
+    }
+
+    static int
+    hevc_type(Nal* nal)
+    {
+        return (nal->data[0] >> 1) & 0x3F;
+    }
+
+    /**
+     * @brief
+     * size of the payload header and FU header in front of every fragment
+     */
+    static int
+    fragment_header_size(Packetizer* packetizer)
+    {
+        return packetizer->header + 1;
+    }
+
+    /**
+     * @brief
+     * upper bound of the packet count, aggregation only lower it
+     */
+    static int
+    packet_count(Packetizer* packetizer)
+    {
+        int max_payload = packetizer->mtu - RTP_HEADER_SIZE;
+        int fragment = max_payload - fragment_header_size(packetizer);
+
+        int count = 0;
+        for(int i = 0; i < packetizer->nal_count; i++) {
+            int size = packetizer->nals[i].size - packetizer->header;
+            count += size + packetizer->header > max_payload ? (size + fragment - 1) / fragment : 1;
+        }
+        return count;
+    }
+
+    /**
+     * @brief
+     * append an empty packet to batch, its rtp header is written by stamp
+     */
+    static RtpPacket*
+    next_packet(RtpBatch* batch)
+    {
+        RtpPacket* packet = &batch->packets[batch->count++];
+        packet->prefix_size = 0;
+        packet->slice_count = 0;
+        packet->size        = RTP_HEADER_SIZE;
+        packet->marker      = FALSE;
+        return packet;
+    }
+
+    static void
+    add_slice(RtpPacket* packet,
+              byte* data,
+              int size)
+    {
+        packet->slices[packet->slice_count].data = data;
+        packet->slices[packet->slice_count].size = size;
+        packet->slice_count++;
+        packet->size += size;
+    }
+
+    /**
+     * @brief
+     * STAP-A header, F is set if any aggregated nal has it, NRI is the highest one
+     */
+    static void
+    h264_aggregation_header(Nal* nals,
+                            int count,
+                            byte* out)
+    {
+        byte forbidden = 0;
+        byte nri = 0;
+        for(int i = 0; i < count; i++) {
+            forbidden |= nals[i].data[0] & 0x80;
+            nri = MAX(nri, nals[i].data[0] & 0x60);
+        }
+        out[0] = forbidden | nri | H264_STAP_A;
+    }
+
+    /**
+     * @brief
+     * AP payload header, F is set if any aggregated nal has it,
+     * LayerId and TID are the lowest ones
+     */
+    static void
+    hevc_aggregation_header(Nal* nals,
+                            int count,
+                            byte* out)
+    {
+        byte forbidden = 0;
+        int layer = 0x3F;
+        int tid = 0x07;
+        for(int i = 0; i < count; i++) {
+            forbidden |= nals[i].data[0] & 0x80;
+            layer = MIN(layer, ((nals[i].data[0] & 0x01) << 5) | (nals[i].data[1] >> 3));
+            tid   = MIN(tid, nals[i].data[1] & 0x07);
+        }
+        out[0] = forbidden | (HEVC_AP << 1) | (layer >> 5);
+        out[1] = ((layer & 0x1F) << 3) | tid;
+    }
+
+    /**
+     * @brief
+     * nals [first, last) go out as a single nal unit packet,
+     * or as one STAP-A / AP
+     */
+    static void
+    aggregate(Packetizer* packetizer,
+              RtpBatch* batch,
+              int first,
+              int last)
+    {
+        if(first == last)
+            return;
+
+        RtpPacket* packet = next_packet(batch);
+        Nal* nals = packetizer->nals;
+
+        if(last - first == 1) {
+            add_slice(packet, nals[first].data, nals[first].size);
+            return;
+        }
+
+        if(packetizer->codec == AV_CODEC_ID_HEVC)
+            hevc_aggregation_header(nals + first, last - first, packet->prefix);
+        else
+            h264_aggregation_header(nals + first, last - first, packet->prefix);
+
+        // first length follow the aggregation header, the others sit between two nals
+        int header = packetizer->header;
+        packet->prefix[header]     = nals[first].size >> 8;
+        packet->prefix[header + 1] = nals[first].size & 0xff;
+        packet->prefix_size = header + 2;
+        packet->size       += packet->prefix_size;
+        add_slice(packet, nals[first].data, nals[first].size);
+
+        for(int i = first + 1; i < last; i++) {
+            byte* length = packet->lengths + 2 * (i - first);
+            length[0] = nals[i].size >> 8;
+            length[1] = nals[i].size & 0xff;
+            add_slice(packet, length, 2);
+            add_slice(packet, nals[i].data, nals[i].size);
+        }
+    }
+
+    /**
+     * @brief
+     * write the FU-A indicator and header, or the FU payload header and FU header
+     */
+    static void
+    fragment_header(Packetizer* packetizer,
+                    Nal* nal,
+                    bool start,
+                    bool end,
+                    byte* out)
+    {
+        byte flags = (start ? 0x80 : 0) | (end ? 0x40 : 0);
+        if(packetizer->codec == AV_CODEC_ID_HEVC) {
+            out[0] = (nal->data[0] & 0x81) | (HEVC_FU << 1);
+            out[1] = nal->data[1];
+            out[2] = flags | hevc_type(nal);
+        } else {
+            out[0] = (nal->data[0] & 0xE0) | H264_FU_A;
+            out[1] = flags | (nal->data[0] & 0x1F);
+        }
+    }
+
+    /**
+     * @brief
+     * fragments are sized to fill the mtu, only the last one is shorter
+     */
+    static void
+    fragment(Packetizer* packetizer,
+             RtpBatch* batch,
+             Nal* nal)
+    {
+        int overhead = fragment_header_size(packetizer);
+        int max_size = packetizer->mtu - RTP_HEADER_SIZE - overhead;
+
+        // nal header is carried by the fragment headers
+        byte* data = nal->data + packetizer->header;
+        int remain = nal->size - packetizer->header;
+        bool start = TRUE;
+        while(remain) {
+            int size = MIN(remain, max_size);
+
+            RtpPacket* packet = next_packet(batch);
+            fragment_header(packetizer, nal, start, size == remain, packet->prefix);
+            packet->prefix_size = overhead;
+            packet->size       += overhead;
+            add_slice(packet, data, size);
+
+            data   += size;
+            remain -= size;
+            start   = FALSE;
+        }
+    }
+
+    static void
+    packetize_nals(Packetizer* packetizer,
+                   RtpBatch* batch)
+    {
+        int max_payload = packetizer->mtu - RTP_HEADER_SIZE;
+
+        // nals [first, i) wait for aggregation, aggregated is their STAP-A / AP size
+        int first = 0;
+        int aggregated = 0;
+        for(int i = 0; i < packetizer->nal_count; i++) {
+            Nal* nal = &packetizer->nals[i];
+            if(nal->size > max_payload) {
+                aggregate(packetizer, batch, first, i);
+                fragment(packetizer, batch, nal);
+                first = i + 1;
+                aggregated = 0;
+                continue;
+            }
+
+            if(aggregated && 
+              (aggregated + 2 + nal->size > max_payload || i - first == RTP_AGGREGATE_MAX)) {
+                aggregate(packetizer, batch, first, i);
+                first = i;
+                aggregated = 0;
+            }
+
+            aggregated = (aggregated ? aggregated : packetizer->header) + 2 + nal->size;
+        }
+
+        aggregate(packetizer, batch, first, packetizer->nal_count);
+    }
+
+    /**
+     * @brief
+     * a receiver joining on an IRAP frame need the parameter sets,
+     * encoder with global header only put them in extradata.
+     * they are inserted after the access unit delimiter, 
+     * and end up aggregated into a single AP.
+     * return TRUE if they were inserted
+     */
+    static bool
+    hevc_insert_parameter_sets(Packetizer* packetizer)
+    {
+        if(!packetizer->parameter_count)
+            return FALSE;
+
+        bool irap = FALSE;
+        for(int i = 0; i < packetizer->nal_count; i++) {
+            int type = hevc_type(&packetizer->nals[i]);
+            if(type == HEVC_VPS)
+                return FALSE;
+            if(type >= HEVC_IRAP_FIRST && type <= HEVC_IRAP_LAST)
+                irap = TRUE;
+        }
+        if(!irap)
+            return FALSE;
+
+        int count = packetizer->nal_count + packetizer->parameter_count;
+        if(count > packetizer->nal_capacity) {
+            packetizer->nal_capacity = count;
+            packetizer->nals = (Nal*)realloc(packetizer->nals, count * sizeof(Nal));
+        }
+
+        int at = hevc_type(&packetizer->nals[0]) == HEVC_AUD ? 1 : 0;
+        memmove(packetizer->nals + at + packetizer->parameter_count,
+                packetizer->nals + at,
+                (packetizer->nal_count - at) * sizeof(Nal));
+        memcpy(packetizer->nals + at,
+               packetizer->parameter_sets,
+               packetizer->parameter_count * sizeof(Nal));
+        packetizer->nal_count = count;
+        return TRUE;
+    }
+
+    /**
+     * @brief
+     * keep the VPS/SPS/PPS of annex-b extradata,
+     * hvcC extradata is left alone
+     */
+    static void
+    hevc_parameter_sets(Packetizer* packetizer,
+                        libav::CodecParameters* params)
+    {
+        if(params->extradata_size < 4 || params->extradata[0] || params->extradata[1])
+            return;
+
+        BUFFER_DUPLICATE(extradata, params->extradata_size, params->extradata, data);
+        packetizer->extradata = extradata;
+
+        find_nals(packetizer, (byte*)data, params->extradata_size);
+        packetizer->parameter_sets = (Nal*)malloc(MAX(packetizer->nal_count, 1) * sizeof(Nal));
+        for(int i = 0; i < packetizer->nal_count; i++) {
+            int type = hevc_type(&packetizer->nals[i]);
+            if(packetizer->nals[i].size >= 2 && type >= HEVC_VPS && type <= HEVC_PPS)
+                packetizer->parameter_sets[packetizer->parameter_count++] = packetizer->nals[i];
+        }
+        packetizer->nal_count = 0;
+    }
+
+    Packetizer*
+    packetizer_init(libav::CodecParameters* params,
+                    int mtu)
+    {
+        if(params->codec_id != AV_CODEC_ID_H264 && 
+           params->codec_id != AV_CODEC_ID_HEVC)
+            return NULL;
+
+        // room for the header and at least a few bytes of FU payload
+        if(mtu < RTP_HEADER_SIZE + 64) {
+            LOG_ERROR("packet size is too small for rtp");
+            return NULL;
+        }
+
+        Packetizer* packetizer = (Packetizer*)malloc(sizeof(Packetizer));
+        memset(packetizer,0,sizeof(Packetizer));
+
+        packetizer->codec  = params->codec_id;
+        packetizer->header = params->codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+        packetizer->mtu    = mtu;
+        packetizer->pool   = BUFFER_POOL_CLASS->init(sizeof(RtpBatch) + PACKETIZER_BLOCK_PACKETS * sizeof(RtpPacket),
+                                                     PACKETIZER_POOL_MAX_FREE);
+
+        if(packetizer->codec == AV_CODEC_ID_HEVC)
+            hevc_parameter_sets(packetizer, params);
+        return packetizer;
+    }
+
+    static void
+    batch_free(pointer data)
+    {
+        RtpBatch* batch = (RtpBatch*)data;
+        BUFFER_CLASS->unref(batch->source);
+        if(batch->extradata)
+            BUFFER_CLASS->unref(batch->extradata);
+        BUFFER_POOL_CLASS->release(batch);
+    }
+
+    util::Buffer*
+    packetizer_packetize(Packetizer* packetizer,
+                         util::Buffer* buf,
+                         int64 timestamp)
+    {
+        int size;
+        libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(buf,&size);
+        if(size != sizeof(libav::Packet)) {
+            LOG_ERROR("wrong datatype");
+            BUFFER_CLASS->unref(buf);
+            return NULL;
+        }
+
+        packetizer->nal_count = 0;
+        if(!find_nals(packetizer, packet->data, packet->size)) {
+            LOG_ERROR("packet is not an annex-b access unit");
+            BUFFER_CLASS->unref(buf);
+            return NULL;
+        }
+
+        bool parameter_sets = packetizer->codec == AV_CODEC_ID_HEVC &&
+                              hevc_insert_parameter_sets(packetizer);
+
+        // descriptors follow the batch in the same block
+        int count = packet_count(packetizer);
+        RtpBatch* batch = (RtpBatch*)BUFFER_POOL_CLASS->acquire(packetizer->pool, 
+                                                                sizeof(RtpBatch) + count * sizeof(RtpPacket));
+        if(!batch) {
+            BUFFER_CLASS->unref(buf);
+            return NULL;
+        }
+
+        memset(batch,0,sizeof(RtpBatch));
+        batch->packet    = packet;
+        batch->source    = buf;
+        batch->timestamp = (uint32)timestamp;
+        batch->packets   = (RtpPacket*)(batch + 1);
+        if(parameter_sets) {
+            BUFFER_CLASS->ref(packetizer->extradata,NULL);
+            batch->extradata = packetizer->extradata;
+        }
+
+        packetize_nals(packetizer, batch);
+
+        // marker on the last packet of the access unit
+        batch->packets[batch->count - 1].marker = TRUE;
+        return BUFFER_CLASS->init(batch, sizeof(RtpBatch), batch_free);
+    }
+
+    void
+    packetizer_source(RtpSource* source)
+    {
+        std::random_device random;
+        source->ssrc             = random();
+        source->timestamp_offset = random();
+        source->sequence         = random() & 0xffff;
+    }
+
+    void
+    packetizer_stamp(RtpSource* source,
+                     RtpBatch* batch,
+                     byte* headers)
+    {
+        uint32 timestamp = batch->timestamp + source->timestamp_offset;
+        for(int i = 0; i < batch->count; i++) {
+            RtpPacket* packet = &batch->packets[i];
+            byte* header = headers + i * RTP_PACKET_HEADER_MAX;
+
+            unsigned short sequence = source->sequence++;
+            header[0]  = 0x80;
+            header[1]  = RTP_PAYLOAD_TYPE | (packet->marker ? 0x80 : 0);
+            header[2]  = sequence >> 8;
+            header[3]  = sequence & 0xff;
+            header[4]  = timestamp >> 24;
+            header[5]  = (timestamp >> 16) & 0xff;
+            header[6]  = (timestamp >> 8) & 0xff;
+            header[7]  = timestamp & 0xff;
+            header[8]  = source->ssrc >> 24;
+            header[9]  = (source->ssrc >> 16) & 0xff;
+            header[10] = (source->ssrc >> 8) & 0xff;
+            header[11] = source->ssrc & 0xff;
+            memcpy(header + RTP_HEADER_SIZE, packet->prefix, packet->prefix_size);
+        }
+    }
+
+    void
+    packetizer_finalize(Packetizer* packetizer)
+    {
+        if(!packetizer)
+            return;
+
+        // blocks of batches still referenced are freed on release
+        BUFFER_POOL_CLASS->finalize(packetizer->pool);
+        if(packetizer->extradata)
+            BUFFER_CLASS->unref(packetizer->extradata);
+        free(packetizer->parameter_sets);
+        free(packetizer->nals);
+        free(packetizer);
+    }
+
+    PacketizerClass*
+    packetizer_class_init()
+    {
+        static bool initialized = false;
+        static PacketizerClass klass = {0};
+        if (initialized)
+            return &klass;
+
+        klass.init      = packetizer_init;
+        klass.packetize = packetizer_packetize;
+        klass.source    = packetizer_source;
+        klass.stamp     = packetizer_stamp;
+        klass.finalize  = packetizer_finalize;
+        initialized = true;
+        return &klass;
+    }
+} // namespace rtp
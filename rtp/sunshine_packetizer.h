@@ -0,0 +1,157 @@
+/**
+ * @file sunshine_packetizer.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __SUNSHINE_PACKETIZER_H__
+#define __SUNSHINE_PACKETIZER_H__
+
+#include <sunshine_util.h>
+
+#define PACKETIZER_CLASS        rtp::packetizer_class_init()
+
+#define RTP_HEADER_SIZE         12
+
+// first dynamic payload type, same as the avformat rtp muxer
+#define RTP_PAYLOAD_TYPE        96
+
+#define RTP_CLOCK_RATE          90000
+
+// payload header written right after the rtp header,
+// FU indicator and FU header, or aggregation header and the first nal length
+#define RTP_PREFIX_MAX          4
+
+// rtp header and prefix of one packet, written for each receiver
+#define RTP_PACKET_HEADER_MAX   (RTP_HEADER_SIZE + RTP_PREFIX_MAX)
+
+// nal units aggregated into a single STAP-A / AP
+#define RTP_AGGREGATE_MAX       8
+
+// every aggregated nal and the length in front of it, the first length is in the prefix
+#define RTP_PACKET_SLICES       (2 * RTP_AGGREGATE_MAX)
+
+// free blocks kept by one packetizer, a frame is sent before the next one is packetized
+#define PACKETIZER_POOL_MAX_FREE 4
+
+namespace rtp
+{
+    typedef struct _Packetizer Packetizer;
+
+    typedef struct _RtpSlice {
+        byte* data;
+        int size;
+    }RtpSlice;
+
+    /**
+     * @brief
+     * one rtp datagram.
+     *
+     * |--rtp header--|--prefix--|--slice 0--|--slice 1--| ...
+     *
+     * rtp header is written for each receiver by stamp, prefix follow it in the same buffer.
+     * slices point into the encoded access unit, or into lengths for aggregated nal units,
+     * payload is never copied
+     */
+    typedef struct _RtpPacket {
+        byte prefix[RTP_PREFIX_MAX];
+        int prefix_size;
+
+        byte lengths[2 * RTP_AGGREGATE_MAX];
+
+        RtpSlice slices[RTP_PACKET_SLICES];
+        int slice_count;
+
+        /**
+         * @brief
+         * datagram size, rtp header included
+         */
+        int size;
+        bool marker;
+    }RtpPacket;
+
+    /**
+     * @brief
+     * every rtp packet of one access unit, refcounted util::Buffer returned by packetize.
+     * batch keep a reference on the packet buffer its slices point into
+     */
+    typedef struct _RtpBatch {
+        libav::Packet* packet;
+        util::Buffer* source;
+
+        /**
+         * @brief
+         * hevc parameter sets inserted in front of a keyframe, NULL otherwise
+         */
+        util::Buffer* extradata;
+
+        /**
+         * @brief
+         * RTP_CLOCK_RATE unit, receiver add its own offset
+         */
+        uint32 timestamp;
+
+        RtpPacket* packets;
+        int count;
+    }RtpBatch;
+
+    /**
+     * @brief
+     * what differ between two receivers of the same batch
+     */
+    typedef struct _RtpSource {
+        uint32 ssrc;
+        uint32 timestamp_offset;
+        unsigned short sequence;
+    }RtpSource;
+
+    typedef struct _PacketizerClass {
+        /**
+         * @brief
+         * H.264 (rfc 6184) and HEVC (rfc 7798),
+         * mtu is the largest rtp packet, header included.
+         * return NULL if codec has no native packetization
+         */
+        Packetizer*     (*init)         (libav::CodecParameters* params,
+                                         int mtu);
+
+        /**
+         * @brief
+         * split the annex-b access unit in packet (util::Buffer of libav::Packet) into rtp packets,
+         * timestamp is in RTP_CLOCK_RATE unit.
+         * return a util::Buffer of RtpBatch, NULL on error
+         */
+        util::Buffer*   (*packetize)    (Packetizer* packetizer,
+                                         util::Buffer* packet,
+                                         int64 timestamp);
+
+        /**
+         * @brief
+         * random ssrc, timestamp offset and first sequence number of a new receiver
+         */
+        void            (*source)       (RtpSource* source);
+
+        /**
+         * @brief
+         * write the rtp header and prefix of every packet of batch,
+         * RTP_PACKET_HEADER_MAX bytes apart in headers
+         */
+        void            (*stamp)        (RtpSource* source,
+                                         RtpBatch* batch,
+                                         byte* headers);
+
+        /**
+         * @brief
+         * batch already returned keep working after finalize
+         */
+        void            (*finalize)     (Packetizer* packetizer);
+    } PacketizerClass;
+
+    PacketizerClass*    packetizer_class_init       ();
+} // namespace rtp
+
+#endif
@@ -12,6 +12,7 @@
 #include <sunshine_util.h>
 
 #include <sunshine_rtp.h>
+#include <sunshine_fanout.h>
 #include <sunshine_config.h>
 
 #include <winsock2.h>
@@ -22,129 +23,423 @@
 
 
 #include <thread>
+#include <mutex>
+#include <new>
 
 using namespace std::literals;
 
 namespace rtp
 {
-    typedef struct _BroadcastContext {
-        std::thread video_thread;
+    struct _RtpOutput {
+        util::QueueArray* source;
+
+        /**
+         * @brief 
+         * written by the capture worker when its encode session is (re)created,
+         * read by every viewer sender
+         */
+        std::mutex lock;
+        libav::CodecParameters* params[RTP_MAX_STREAMS];
+        AVRational time_base[RTP_MAX_STREAMS];
+        uint generation[RTP_MAX_STREAMS];
+        uint counter;
+
+        // kbps the encoder currently target, 0 until a session set it
+        int bitrate;
+
+        // base port of the default receiver, stream i go to port + 2 * i
+        int port;
+    };
+
+    RtpOutput*
+    make_rtp_output(util::QueueArray* source,
+                    int port)
+    {
+        RtpOutput* output = (RtpOutput*)malloc(sizeof(RtpOutput));
+        memset((pointer)output,0,sizeof(RtpOutput));
+        new (&output->lock) std::mutex();
 
-        util::Broadcaster* shutdown_event;
-        util::Broadcaster* join_event;
+        output->source = source;
+        output->port   = port;
+        return output;
+    }
 
-        util::QueueArray* packet_queue;
-    }BroadcastContext;
+    util::QueueArray*
+    rtp_output_queue(RtpOutput* output)
+    {
+        return output->source;
+    }
 
-    RtpContext*
-    make_rtp_context(encoder::EncodeContext* encode)
+    void
+    free_rtp_output(RtpOutput* output)
     {
-        static bool init = false;
-        static RtpContext ret;
-        if(!encode)
-            return &ret;
-        if(init)
-            goto done;
+        if(!output)
+            return;
 
-        init = true;
-        ret.format = avformat_alloc_context();
-        ret.format->oformat = av_guess_format("rtp",NULL,NULL);
-        snprintf(ret.format->filename, sizeof(ret.format->filename), 
-            "rtp://%s:%d", "localhost", ENCODER_CONFIG->rtp.port);
+        for(int i = 0; i < RTP_MAX_STREAMS; i++)
+            avcodec_parameters_free(&output->params[i]);
 
-        ret.stream = avformat_new_stream (ret.format, encode->codec);
+        output->lock.~mutex();
+        free(output);
+    }
 
-        avcodec_parameters_from_context(ret.stream->codecpar,encode->context);
-        if (ret.format->oformat->flags & AVFMT_GLOBALHEADER)
-            encode->context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    /**
+     * @brief 
+     * sdp of stream index for the default receiver,
+     * payload type and format parameters are the same for every receiver
+     */
+    static void
+    log_sdp(RtpOutput* output,
+            libav::CodecParameters* params,
+            int index)
+    {
+        libav::FormatContext* format = avformat_alloc_context();
+        format->oformat = av_guess_format("rtp",NULL,NULL);
+        snprintf(format->filename, sizeof(format->filename), 
+            "rtp://localhost:%d", output->port + 2 * index);
+
+        libav::Stream* stream = avformat_new_stream(format, NULL);
+        if(stream && avcodec_parameters_copy(stream->codecpar, params) >= 0) {
+            char sdp[4096];
+            if(av_sdp_create(&format, 1, sdp, sizeof(sdp)) < 0)
+                LOG_WARNING("failed to create sdp");
+            else
+                LOG_INFO(sdp);
+        }
+        avformat_free_context(format);
+    }
 
+    int
+    register_stream(RtpOutput* output,
+                    encoder::EncodeContext* encode,
+                    int index)
+    {
+        if(index < 0 || index >= RTP_MAX_STREAMS)
+            return -1;
 
-        ret.format->streams[0] = ret.stream;
-        if (avio_open(&ret.format->pb, ret.format->filename, AVIO_FLAG_WRITE) < 0){
-            LOG_ERROR("Error opening output file");
-            return NULL;
-        }
+        std::lock_guard<std::mutex> guard(output->lock);
+        if(!output->params[index])
+            output->params[index] = avcodec_parameters_alloc();
 
+        if(avcodec_parameters_from_context(output->params[index], encode->context) < 0)
+            return -1;
 
-        char buf[200000];
-        av_sdp_create(&ret.format, 1, buf, 20000);
-        printf("sdp:\n%s\n", buf);
+        output->time_base[index]  = encode->context->time_base;
+        output->generation[index] = ++output->counter;
+        log_sdp(output, output->params[index], index);
+        return 0;
+    }
 
-        return &ret;
-        done:
-        avcodec_parameters_from_context(ret.stream->codecpar,encode->context);
-        if (ret.format->oformat->flags & AVFMT_GLOBALHEADER)
-            encode->context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-        return &ret;
+    void
+    set_output_bitrate(RtpOutput* output,
+                       int bitrate)
+    {
+        std::lock_guard<std::mutex> guard(output->lock);
+        output->bitrate = bitrate;
     }
 
+    int
+    output_bitrate(RtpOutput* output)
+    {
+        std::lock_guard<std::mutex> guard(output->lock);
+        return output->bitrate;
+    }
 
+    uint
+    stream_generation(RtpOutput* output,
+                      int index)
+    {
+        if(index < 0 || index >= RTP_MAX_STREAMS)
+            return 0;
+
+        std::lock_guard<std::mutex> guard(output->lock);
+        return output->generation[index];
+    }
+
+    libav::CodecID
+    stream_codec(RtpOutput* output,
+                 int index)
+    {
+        if(index < 0 || index >= RTP_MAX_STREAMS)
+            return AV_CODEC_ID_NONE;
+
+        std::lock_guard<std::mutex> guard(output->lock);
+        return output->params[index] ? output->params[index]->codec_id : AV_CODEC_ID_NONE;
+    }
+
+    static void
+    free_rtp_frame(pointer data)
+    {
+        RtpFrame* frame = (RtpFrame*)data;
+        BUFFER_CLASS->unref(frame->packet);
+        if(frame->batch)
+            BUFFER_CLASS->unref(frame->batch);
+        free(frame);
+    }
+
+    void
+    close_rtp_stream(RtpStream* stream)
+    {
+        // batches already queued to receivers outlive the packetizer
+        PACKETIZER_CLASS->finalize(stream->packetizer);
+        memset(stream,0,sizeof(RtpStream));
+    }
+
+    static void
+    open_rtp_stream(RtpOutput* output,
+                    RtpStream* stream,
+                    int index)
+    {
+        close_rtp_stream(stream);
+
+        std::lock_guard<std::mutex> guard(output->lock);
+        if(!output->params[index])
+            return;
+
+        stream->packetizer = PACKETIZER_CLASS->init(output->params[index],
+                                                    ENCODER_CONFIG->packet_size);
+        stream->time_base  = output->time_base[index];
+        stream->generation = output->generation[index];
+    }
+
+    util::Buffer*
+    make_rtp_frame(RtpOutput* output,
+                   RtpStream* stream,
+                   int index,
+                   util::Buffer* buf)
+    {
+        if(index < 0 || index >= RTP_MAX_STREAMS)
+            return NULL;
+
+        // encode session was recreated, codec parameters are different
+        if(stream->generation != stream_generation(output, index))
+            open_rtp_stream(output, stream, index);
+
+        util::Buffer* batch = NULL;
+        if(stream->packetizer) {
+            libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(buf,NULL);
+            int64 timestamp = av_rescale_q(packet->pts, stream->time_base, AVRational { 1, RTP_CLOCK_RATE });
+            batch = PACKETIZER_CLASS->packetize(stream->packetizer, buf, timestamp);
+            BUFFER_CLASS->unref(buf);
+            if(!batch)
+                return NULL;
+        }
+
+        RtpFrame* frame = (RtpFrame*)malloc(sizeof(RtpFrame));
+        BUFFER_CLASS->ref(buf,NULL);
+        frame->packet     = buf;
+        frame->batch      = batch;
+        frame->generation = stream->generation;
+        return BUFFER_CLASS->init(frame, sizeof(RtpFrame), free_rtp_frame);
+    }
 
     /**
      * @brief 
-     * 
-     * @param sock 
+     * avformat muxer for codecs the packetizer does not handle
      */
-    void 
-    videoBroadcastThread(BroadcastContext* ctx) 
+    static int
+    open_muxer(RtpContext* ret,
+               RtpOutput* output,
+               int index,
+               char* address,
+               int port)
     {
-        util::QueueArray* packets = ctx->packet_queue;
-        util::Broadcaster* shutdown_event = ctx->shutdown_event;
+        ret->format = avformat_alloc_context();
+        ret->format->oformat = av_guess_format("rtp",NULL,NULL);
+        snprintf(ret->format->filename, sizeof(ret->format->filename), 
+            "rtp://%s:%d", address, port);
+
+        ret->stream = avformat_new_stream (ret->format, NULL);
+
+        {
+            std::lock_guard<std::mutex> guard(output->lock);
+            if(!output->params[index] || output->generation[index] != ret->generation) {
+                LOG_ERROR("stream is not registered");
+                return -1;
+            }
 
+            avcodec_parameters_copy(ret->stream->codecpar, output->params[index]);
+            ret->time_base = output->time_base[index];
+        }
 
-        while(TRUE) {
-            if(!QUEUE_ARRAY_CLASS->peek(packets)) {
-                std::this_thread::sleep_for(1ms);
-                continue;
+        if (avio_open(&ret->format->pb, ret->format->filename, AVIO_FLAG_WRITE) < 0){
+            LOG_ERROR("Error opening output file");
+            return -1;
+        }
+        return 0;
+    }
+
+    RtpContext*
+    open_rtp_context(RtpOutput* output,
+                     RtpFrame* frame,
+                     char* address,
+                     int port)
+    {
+        libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(frame->packet,NULL);
+        int index = packet->stream_index;
+        BUFFER_CLASS->unref(frame->packet);
+
+        RtpContext* ret = (RtpContext*)malloc(sizeof(RtpContext));
+        memset(ret,0,sizeof(RtpContext));
+        ret->generation = frame->generation;
+
+        if(!frame->batch) {
+            if(open_muxer(ret, output, index, address, port)) {
+                close_rtp_context(ret);
+                return NULL;
             }
+            return ret;
+        }
+
+        ret->socket = udp_open(address, 
+                               port, 
+                               (ENCODER_CONFIG->udp_gso ? UDP_GSO : 0) |
+                               (ENCODER_CONFIG->udp_zerocopy ? UDP_ZEROCOPY : 0));
+        if(!ret->socket) {
+            free(ret);
+            return NULL;
+        }
 
-            if(IS_INVOKED(shutdown_event))
-                break;
+        PACKETIZER_CLASS->source(&ret->source);
+        ret->headers = BUFFER_POOL_CLASS->init(RTP_HEADERS_BLOCK_PACKETS * RTP_PACKET_HEADER_MAX,
+                                               RTP_HEADERS_POOL_MAX_FREE);
+        return ret;
+    }
 
-            int size;
-            util::Buffer* video_packet_buffer;
-            libav::Packet* av_packet = (libav::Packet*)QUEUE_ARRAY_CLASS->pop(packets,&video_packet_buffer,&size);
-            if(size != sizeof(libav::Packet)) {
-                LOG_ERROR("wrong datatype");
-                continue;
-            }
+    /**
+     * @brief 
+     * datagrams are gathered from this receiver headers and the shared batch,
+     * the payload is not copied before the socket
+     */
+    static int
+    send_rtp_batch(RtpContext* rtp,
+                   util::Buffer* buf)
+    {
+        RtpBatch* batch = (RtpBatch*)BUFFER_CLASS->ref(buf,NULL);
+        int count = batch->count;
+
+        pointer headers = BUFFER_POOL_CLASS->acquire(rtp->headers, count * RTP_PACKET_HEADER_MAX);
+        int sent = -1;
+        if(headers) {
+            PACKETIZER_CLASS->stamp(&rtp->source, batch, (byte*)headers);
+            sent = udp_send(rtp->socket, buf, &headers);
+        }
 
-            RtpContext* rtp = make_rtp_context(NULL);
+        // socket keep what zerocopy still send from
+        BUFFER_POOL_CLASS->release(headers);
+        BUFFER_CLASS->unref(buf);
+
+        // a frame with missing fragments cannot be decoded, resync on a keyframe
+        if(sent != count) {
+            char log[128];
+            snprintf(log, sizeof(log), "sent %d of %d rtp packets", MAX(sent, 0), count);
+            LOG_WARNING(log);
+            return -1;
+        }
+        return 0;
+    }
 
-            if(avformat_write_header(rtp->format,NULL) != 0) {
+    static int
+    write_muxer_packet(RtpContext* rtp,
+                       libav::Packet* packet)
+    {
+        // muxer is initialized once, it keep ssrc and sequence number from there
+        if(!rtp->header) {
+            if(avformat_write_header(rtp->format,NULL) < 0) {
                 LOG_ERROR("write header failed");
-                break;
-            }
-            // TODO
-            if(av_write_frame(rtp->format, av_packet) != 0) {
-                LOG_ERROR("write failed");
-                break;
+                return -1;
             }
+            rtp->header = TRUE;
+        }
+
+        // packet is shared between receivers, muxer rewrite timestamps in place
+        libav::Packet* out = av_packet_alloc();
+        if(av_packet_ref(out, packet) < 0) {
+            av_packet_free(&out);
+            return -1;
+        }
+
+        out->stream_index = 0;
+        av_packet_rescale_ts(out, rtp->time_base, rtp->stream->time_base);
+
+        int ret = av_write_frame(rtp->format, out);
+        av_packet_free(&out);
+        if(ret != 0) {
+            LOG_ERROR("write failed");
+            return -1;
+        }
+        return 0;
+    }
+
+    int
+    write_rtp_packet(RtpContext* rtp,
+                     RtpFrame* frame)
+    {
+        if(rtp->socket)
+            return frame->batch ? send_rtp_batch(rtp, frame->batch) : -1;
+
+        libav::Packet* packet = (libav::Packet*)BUFFER_CLASS->ref(frame->packet,NULL);
+        int ret = write_muxer_packet(rtp, packet);
+        BUFFER_CLASS->unref(frame->packet);
+        return ret;
+    }
+
+    void
+    close_rtp_context(RtpContext* rtp)
+    {
+        if(!rtp)
+            return;
+
+        if(rtp->header)
+            av_write_trailer(rtp->format);
 
-            BUFFER_CLASS->unref(video_packet_buffer);
+        if(rtp->socket) {
+            udp_close(rtp->socket);
+            BUFFER_POOL_CLASS->finalize(rtp->headers);
         }
 
-        RAISE_EVENT(shutdown_event);
-        RAISE_EVENT(ctx->join_event);
+        if(rtp->format) {
+            avio_closep(&rtp->format->pb);
+            avformat_free_context(rtp->format);
+        }
+        free(rtp);
     }
 
 
     /**
      * @brief 
+     * deliver output to the default receiver, 
+     * more receiver can join the same fanout
      * 
-     * @param ctx 
+     * @param shutdown_event 
+     * @param output 
+     * @param port      port of the default receiver
+     * @param bitrate   kbps, used to pace the default receiver
+     * @param request called when a receiver need a keyframe
+     * @param data 
      * @return int 
      */
     int 
     start_broadcast(util::Broadcaster* shutdown_event,
-                    util::QueueArray* packet_queue) 
-    {
-        BroadcastContext ctx;
-        memset(&ctx,0,sizeof(BroadcastContext));
-        ctx.packet_queue = packet_queue;
-        ctx.shutdown_event = shutdown_event;
-        ctx.join_event = NEW_EVENT;
-        ctx.video_thread = std::thread { videoBroadcastThread, &ctx};
-        WAIT_EVENT(ctx.join_event);
+                    RtpOutput* output,
+                    int port,
+                    int bitrate,
+                    KeyframeRequest request,
+                    pointer data) 
+    {
+        Fanout* fanout = FANOUT_CLASS->init(output, shutdown_event, request, data);
+        if(!fanout) {
+            RAISE_EVENT(shutdown_event);
+            return -1;
+        }
+
+        FANOUT_CLASS->join(fanout, 
+                           "localhost", 
+                           port, 
+                           bitrate);
+
+        WAIT_EVENT(shutdown_event);
+        FANOUT_CLASS->finalize(fanout);
+        return 0;
     }
 } // namespace rtp
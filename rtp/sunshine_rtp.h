@@ -11,21 +11,186 @@
 #ifndef __SUNSHINE_RTP_H__
 #define __SUNSHINE_RTP_H__
 #include <sunshine_util.h>
+#include <sunshine_packetizer.h>
+#include <sunshine_udp.h>
+
+/**
+ * one rtp stream per encoded stripe.
+ * without stream_slices only stream 0 exist and carry the whole picture.
+ * with stream_slices, stream i is an independent H.264/HEVC bitstream 
+ * of the i-th horizontal band of the picture, sent to port + 2 * i.
+ * the receiver decode every stream with its own decoder 
+ * and stack the decoded bands top to bottom, 
+ * bands of one picture share the same rtp timestamp and stream 0 always carry the first one
+ */
+#define RTP_MAX_STREAMS 16
+
+// port range used by one rendition, every stream take an rtp/rtcp pair
+#define RTP_RENDITION_PORTS (2 * RTP_MAX_STREAMS)
+
+// rtp headers of one receiver, a block hold the headers of the usual P-frame
+#define RTP_HEADERS_BLOCK_PACKETS   64
+#define RTP_HEADERS_POOL_MAX_FREE   4
 
 namespace rtp
 {
     struct _RtpContext {
+        /**
+         * @brief 
+         * avformat muxer, only for codecs without native packetization
+         */
         libav::Stream* stream;
         libav::FormatContext* format;
+        AVRational time_base;
+        bool header;
+
+        /**
+         * @brief 
+         * native packetization, the shared batch is sent through socket
+         * with the ssrc and sequence number of this receiver,
+         * headers of a frame are written into a block of the headers pool
+         */
+        UdpSocket* socket;
+        RtpSource source;
+        util::BufferPool* headers;
+
+        /**
+         * @brief 
+         * stream description this context was opened from
+         */
+        uint generation;
     };
 
+    /**
+     * @brief 
+     * packetization of one stream index of an output, 
+     * done once for every receiver
+     */
+    typedef struct _RtpStream {
+        /**
+         * @brief 
+         * NULL when the codec go through the avformat muxer
+         */
+        Packetizer* packetizer;
+        AVRational time_base;
+        uint generation;
+    }RtpStream;
+
+    /**
+     * @brief 
+     * one encoded packet as queued to the receivers of an output
+     */
+    typedef struct _RtpFrame {
+        /**
+         * @brief 
+         * util::Buffer of libav::Packet
+         */
+        util::Buffer* packet;
+
+        /**
+         * @brief 
+         * util::Buffer of RtpBatch, NULL when the codec go through the avformat muxer
+         */
+        util::Buffer* batch;
+
+        /**
+         * @brief 
+         * stream description the frame was packetized with
+         */
+        uint generation;
+    }RtpFrame;
+
+    typedef void (*KeyframeRequest) (pointer data);
+
+    /**
+     * @brief 
+     * rtp output of one rendition of a session,
+     * packets pushed to source and the description of their streams.
+     * it is created with the session, and outlive its capture and broadcast threads.
+     * port is the base port of the default receiver, only used to describe the streams
+     */
+    RtpOutput*      make_rtp_output     (util::QueueArray* source,
+                                         int port);
+
+    util::QueueArray* rtp_output_queue  (RtpOutput* output);
+
+    void            free_rtp_output     (RtpOutput* output);
+
+    /**
+     * @brief 
+     * publish the codec parameters of stream index for packets pushed to output,
+     * context opened afterward use the new parameters.
+     * the sdp of the stream is logged once here, not for every receiver
+     */
+    int             register_stream     (RtpOutput* output,
+                                         encoder::EncodeContext* encode,
+                                         int index);
+
+    /**
+     * @brief 
+     * bitrate in kbps the encoder of output currently target,
+     * set on every session (re)creation and reconfiguration, read to pace the viewers
+     */
+    void            set_output_bitrate  (RtpOutput* output,
+                                         int bitrate);
+
+    int             output_bitrate      (RtpOutput* output);
+
+    /**
+     * @brief 
+     * return the generation of the stream description, 0 if not registered
+     */
+    uint            stream_generation   (RtpOutput* output,
+                                         int index);
+
+    /**
+     * @brief 
+     * codec receivers of stream index decode, AV_CODEC_ID_NONE if not registered
+     */
+    libav::CodecID  stream_codec        (RtpOutput* output,
+                                         int index);
+
+    /**
+     * @brief 
+     * wrap packet (util::Buffer of libav::Packet) of stream index into a util::Buffer of RtpFrame.
+     * H.264 and HEVC are packetized natively within ENCODER_CONFIG->packet_size,
+     * stream is reopened when the encode session was recreated.
+     * return NULL if packet could not be packetized
+     */
+    util::Buffer*   make_rtp_frame      (RtpOutput* output,
+                                         RtpStream* stream,
+                                         int index,
+                                         util::Buffer* packet);
+
+    void            close_rtp_stream    (RtpStream* stream);
+
+    /**
+     * @brief 
+     * rtp context carry a single stream to one receiver, 
+     * one context is opened for each stream index and each receiver,
+     * from a frame of the stream generation it will send
+     */
+    RtpContext*     open_rtp_context    (RtpOutput* output,
+                                         RtpFrame* frame,
+                                         char* address,
+                                         int port);
 
+    /**
+     * @brief 
+     * frame is not modified, batch header are written for this receiver only
+     */
+    int             write_rtp_packet    (RtpContext* rtp,
+                                         RtpFrame* frame);
 
-    RtpContext*     make_rtp_context(encoder::EncodeContext* encode);
+    void            close_rtp_context   (RtpContext* rtp);
 
-    int             start_broadcast (util::Broadcaster* shutdown_event,
-                                     util::QueueArray* packet_queue) ;
+    int             start_broadcast     (util::Broadcaster* shutdown_event,
+                                         RtpOutput* output,
+                                         int port,
+                                         int bitrate,
+                                         KeyframeRequest request,
+                                         pointer data);
 } // namespace rtp
 
 
-#endif
\ No newline at end of file
+#endif
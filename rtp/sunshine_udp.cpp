@@ -0,0 +1,712 @@
+/**
+ * @file sunshine_udp.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifdef _WIN32
+// WSASendMsg and WSA_CMSG_* are only declared for vista and later,
+// older mingw headers default to xp
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef  _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#endif
+#include <sunshine_udp.h>
+#include <sunshine_util.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+typedef SOCKET socket_t;
+typedef WSABUF udp_buf_t;
+#define close_socket closesocket
+#define set_buf(buf, data, size) ((buf)->buf = (char*)(data), (buf)->len = (ULONG)(size))
+
+// udp send offload, windows 10 1703 and later
+#ifndef UDP_SEND_MSG_SIZE
+#define UDP_SEND_MSG_SIZE 2
+#endif
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+typedef int socket_t;
+typedef struct iovec udp_buf_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#define set_buf(buf, data, size) ((buf)->iov_base = (data), (buf)->iov_len = (size))
+#endif
+
+// datagrams handed to the kernel by one sendmmsg call
+#define UDP_BATCH_MAX 256
+
+// gather entries of one message (linux UIO_MAXIOV), and of one sendmmsg call
+#define UDP_MESSAGE_BUFS 1024
+#define UDP_BATCH_BUFS   4096
+
+// kernel limits of one segmented send, a run of packets is cut to stay below
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES    64000
+
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// smaller frames are always sent with a copy
+#define UDP_ZEROCOPY_MIN_BYTES      (64 * 1024)
+
+// frames the kernel may still be sending from, more are sent with a copy
+#define UDP_ZEROCOPY_MAX_PENDING    64
+
+// time given to the kernel to complete in-flight frames when the socket close
+#define UDP_ZEROCOPY_DRAIN_MS       100
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rtp
+{
+#ifdef __linux__
+    /**
+     * @brief
+     * frame sent with MSG_ZEROCOPY, batch is referenced and headers is a pool block.
+     * the kernel notify the completion of send calls [first, first + count)
+     */
+    typedef struct _ZerocopyPending {
+        util::Buffer* batch;
+        pointer headers;
+        uint32 first;
+        uint32 count;
+        uint32 remaining;
+    }ZerocopyPending;
+#endif
+
+    struct _UdpSocket {
+        socket_t fd;
+
+        /**
+         * @brief
+         * runs of equal size packets are sent as one segmented datagram
+         * (UDP_SEGMENT on linux, UDP_SEND_MSG_SIZE on windows),
+         * cleared when the kernel or the route reject it
+         */
+        bool gso;
+
+        /**
+         * @brief
+         * gather entries of one message outside of sendmmsg
+         */
+        udp_buf_t bufs[UDP_MESSAGE_BUFS];
+
+#ifdef __linux__
+        /**
+         * @brief
+         * cleared when the kernel does not implement sendmmsg
+         */
+        bool mmsg;
+
+        /**
+         * @brief
+         * message i carry runs[i] packets, its gather entries follow those of message i - 1 in iovs
+         */
+        struct mmsghdr msgs[UDP_BATCH_MAX];
+        struct iovec iovs[UDP_BATCH_BUFS];
+        int runs[UDP_BATCH_MAX];
+        char control[UDP_BATCH_MAX][CMSG_SPACE(sizeof(unsigned short))];
+
+        /**
+         * @brief
+         * cleared when the kernel copy anyway, pending frames are still completed.
+         * next_id is the id the kernel give to the next zerocopy send
+         */
+        bool zerocopy;
+        uint32 next_id;
+        ZerocopyPending pending[UDP_ZEROCOPY_MAX_PENDING];
+        int pending_count;
+#endif
+    };
+
+    static bool
+    network_init()
+    {
+#ifdef _WIN32
+        // avio used to do this for the avformat muxer
+        WSADATA data;
+        return !WSAStartup(MAKEWORD(2, 2), &data);
+#else
+        return TRUE;
+#endif
+    }
+
+    /**
+     * @brief
+     * receiver is not listening yet, an earlier datagram came back as port unreachable
+     */
+    static bool
+    refused()
+    {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAECONNRESET;
+#else
+        return errno == ECONNREFUSED;
+#endif
+    }
+
+    static bool
+    gso_supported(socket_t fd)
+    {
+#if defined(_WIN32)
+        DWORD segment = 0;
+        int size = sizeof(segment);
+        return !getsockopt(fd, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*)&segment, &size);
+#elif defined(__linux__)
+        int segment = 0;
+        socklen_t size = sizeof(segment);
+        return !getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &size);
+#else
+        return FALSE;
+#endif
+    }
+
+#ifdef __linux__
+    static bool
+    zerocopy_supported(socket_t fd)
+    {
+        int enable = 1;
+        return !setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable));
+    }
+
+    static void
+    zerocopy_release(ZerocopyPending* pending)
+    {
+        BUFFER_CLASS->unref(pending->batch);
+        BUFFER_POOL_CLASS->release(pending->headers);
+    }
+
+    /**
+     * @brief
+     * send calls [low, high] are done, 
+     * frame whose every send completed is released
+     */
+    static void
+    zerocopy_complete(UdpSocket* sock,
+                      uint32 low,
+                      uint32 high)
+    {
+        int kept = 0;
+        for(int i = 0; i < sock->pending_count; i++) {
+            ZerocopyPending* pending = &sock->pending[i];
+            uint32 first = MAX(low, pending->first);
+            uint32 last  = MIN(high, pending->first + pending->count - 1);
+            if(first <= last)
+                pending->remaining -= last - first + 1;
+
+            if(!pending->remaining) {
+                zerocopy_release(pending);
+                continue;
+            }
+            sock->pending[kept++] = *pending;
+        }
+        sock->pending_count = kept;
+    }
+
+    /**
+     * @brief
+     * read every completion waiting in the socket error queue
+     */
+    static void
+    zerocopy_reap(UdpSocket* sock)
+    {
+        while(sock->pending_count) {
+            char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+            struct msghdr msg;
+            memset(&msg,0,sizeof(msg));
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+
+            if(recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                return;
+
+            for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                   !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                    continue;
+
+                struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+                if(err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+
+                // device cannot send from user pages, the copy was done anyway
+                if((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && sock->zerocopy) {
+                    LOG_WARNING("udp zerocopy fell back to copy, disabling it");
+                    sock->zerocopy = FALSE;
+                }
+
+                zerocopy_complete(sock, err->ee_info, err->ee_data);
+            }
+        }
+    }
+
+    /**
+     * @brief
+     * keep the frame until the kernel completed the last count zerocopy sends
+     */
+    static void
+    zerocopy_hold(UdpSocket* sock,
+                  util::Buffer* batch,
+                  pointer headers,
+                  uint32 count)
+    {
+        ZerocopyPending* pending = &sock->pending[sock->pending_count++];
+        pending->batch     = batch;
+        pending->headers   = headers;
+        pending->first     = sock->next_id;
+        pending->count     = count;
+        pending->remaining = count;
+        sock->next_id += count;
+    }
+
+    static void
+    zerocopy_drain(UdpSocket* sock)
+    {
+        struct pollfd pfd;
+        pfd.fd     = sock->fd;
+        pfd.events = 0;
+
+        // error queue readiness is reported as POLLERR
+        for(int waited = 0; sock->pending_count && waited < UDP_ZEROCOPY_DRAIN_MS; waited += 10) {
+            zerocopy_reap(sock);
+            if(sock->pending_count)
+                poll(&pfd, 1, 10);
+        }
+
+        // socket is closed below, the kernel keep its own reference on the pages
+        for(int i = 0; i < sock->pending_count; i++)
+            zerocopy_release(&sock->pending[i]);
+        sock->pending_count = 0;
+    }
+#endif
+
+    UdpSocket*
+    udp_open(char* address,
+             int port,
+             int flags)
+    {
+        static bool network = network_init();
+        if(!network) {
+            LOG_ERROR("network initialization failed");
+            return NULL;
+        }
+
+        char service[16];
+        snprintf(service, sizeof(service), "%d", port);
+
+        struct addrinfo hints;
+        memset(&hints,0,sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        struct addrinfo* result = NULL;
+        if(getaddrinfo(address, service, &hints, &result) || !result) {
+            LOG_ERROR("failed to resolve receiver address");
+            return NULL;
+        }
+
+        socket_t fd = INVALID_SOCKET;
+        for(struct addrinfo* it = result; it; it = it->ai_next) {
+            fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+            if(fd == INVALID_SOCKET)
+                continue;
+
+            // receiver is fixed, kernel resolve the route once
+            if(!connect(fd, it->ai_addr, (int)it->ai_addrlen))
+                break;
+
+            close_socket(fd);
+            fd = INVALID_SOCKET;
+        }
+        freeaddrinfo(result);
+
+        if(fd == INVALID_SOCKET) {
+            LOG_ERROR("failed to open udp socket");
+            return NULL;
+        }
+
+        UdpSocket* sock = (UdpSocket*)malloc(sizeof(UdpSocket));
+        memset(sock,0,sizeof(UdpSocket));
+        sock->fd = fd;
+        sock->gso = (flags & UDP_GSO) && gso_supported(fd);
+#ifdef __linux__
+        sock->mmsg = TRUE;
+        sock->zerocopy = (flags & UDP_ZEROCOPY) && zerocopy_supported(fd);
+#endif
+        if((flags & UDP_GSO) && !udp_gso(sock))
+            LOG_WARNING("udp gso is not supported, sending one datagram per packet");
+#ifdef __linux__
+        if((flags & UDP_ZEROCOPY) && !sock->zerocopy)
+#else
+        if(flags & UDP_ZEROCOPY)
+#endif
+            LOG_WARNING("udp zerocopy is not supported, packets are copied");
+        return sock;
+    }
+
+    /**
+     * @brief
+     * gather entries of packet index, its header then its payload slices,
+     * return their count
+     */
+    static int
+    gather(RtpBatch* batch,
+           byte* headers,
+           int index,
+           udp_buf_t* bufs)
+    {
+        RtpPacket* packet = &batch->packets[index];
+        set_buf(&bufs[0], headers + index * RTP_PACKET_HEADER_MAX, RTP_HEADER_SIZE + packet->prefix_size);
+        for(int i = 0; i < packet->slice_count; i++)
+            set_buf(&bufs[i + 1], packet->slices[i].data, packet->slices[i].size);
+        return packet->slice_count + 1;
+    }
+
+    static int
+    send_gather(UdpSocket* sock,
+                udp_buf_t* bufs,
+                int count)
+    {
+#ifdef _WIN32
+        DWORD bytes = 0;
+        return WSASend(sock->fd, bufs, count, &bytes, 0, NULL, NULL) == SOCKET_ERROR ? -1 : 0;
+#else
+        struct msghdr msg;
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov    = bufs;
+        msg.msg_iovlen = count;
+        return sendmsg(sock->fd, &msg, 0) < 0 ? -1 : 0;
+#endif
+    }
+
+    /**
+     * @brief
+     * one syscall per datagram, return the number of packets sent
+     */
+    static int
+    send_each(UdpSocket* sock,
+              RtpBatch* batch,
+              byte* headers,
+              int first)
+    {
+        for(int i = first; i < batch->count; i++) {
+            int count = gather(batch, headers, i, sock->bufs);
+            if(send_gather(sock, sock->bufs, count) < 0) {
+                if(refused())
+                    continue;
+
+                LOG_ERROR("udp send failed");
+                return i;
+            }
+        }
+        return batch->count;
+    }
+
+    /**
+     * @brief
+     * number of packets from first that can go out as one segmented datagram,
+     * all but the last have the size of the first.
+     * bufs is their number of gather entries
+     */
+    static int
+    run_length(UdpSocket* sock,
+               RtpBatch* batch,
+               int first,
+               int* bufs)
+    {
+        RtpPacket* packets = batch->packets;
+        *bufs = packets[first].slice_count + 1;
+        if(!sock->gso)
+            return 1;
+
+        int segment = packets[first].size;
+        int bytes = segment;
+        int last = first;
+        while(last + 1 < batch->count &&
+              last + 1 - first < UDP_GSO_MAX_SEGMENTS &&
+              packets[last].size == segment &&
+              packets[last + 1].size <= segment &&
+              bytes + packets[last + 1].size <= UDP_GSO_MAX_BYTES &&
+              *bufs + packets[last + 1].slice_count + 1 <= UDP_MESSAGE_BUFS) {
+            last++;
+            bytes += packets[last].size;
+            *bufs += packets[last].slice_count + 1;
+        }
+        return last - first + 1;
+    }
+
+#ifdef _WIN32
+    /**
+     * @brief
+     * one WSASendMsg per run, the segment size ride along as UDP_SEND_MSG_SIZE,
+     * return the number of packets sent
+     */
+    static int
+    send_uso(UdpSocket* sock,
+             RtpBatch* batch,
+             byte* headers)
+    {
+        int sent = 0;
+        while(sent < batch->count) {
+            int bufs;
+            int run = run_length(sock, batch, sent, &bufs);
+
+            int count = 0;
+            for(int i = sent; i < sent + run; i++)
+                count += gather(batch, headers, i, sock->bufs + count);
+
+            WSAMSG msg;
+            memset(&msg,0,sizeof(msg));
+            msg.lpBuffers     = sock->bufs;
+            msg.dwBufferCount = count;
+
+            // kernel cut the gathered buffer every segment bytes, the last datagram may be shorter
+            union {
+                WSACMSGHDR header;
+                char data[WSA_CMSG_SPACE(sizeof(DWORD))];
+            } control;
+            memset(&control,0,sizeof(control));
+            if(run > 1) {
+                msg.Control.buf = control.data;
+                msg.Control.len = sizeof(control.data);
+
+                WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = IPPROTO_UDP;
+                cmsg->cmsg_type  = UDP_SEND_MSG_SIZE;
+                cmsg->cmsg_len   = WSA_CMSG_LEN(sizeof(DWORD));
+                *(DWORD*)WSA_CMSG_DATA(cmsg) = (DWORD)batch->packets[sent].size;
+            }
+
+            DWORD bytes = 0;
+            if(WSASendMsg(sock->fd, &msg, 0, &bytes, NULL, NULL) == SOCKET_ERROR) {
+                // segment size rejected by the stack or the adapter: resend unsegmented
+                if(run > 1 && WSAGetLastError() == WSAEINVAL) {
+                    LOG_WARNING("udp send offload rejected, sending one datagram per packet");
+                    sock->gso = FALSE;
+                    return send_each(sock, batch, headers, sent);
+                }
+
+                if(refused()) {
+                    sent += run;
+                    continue;
+                }
+
+                LOG_ERROR("udp send failed");
+                return sent;
+            }
+            sent += run;
+        }
+        return sent;
+    }
+#endif
+
+#ifdef __linux__
+    /**
+     * @brief
+     * message for the run of count packets from first, 
+     * gathered into the socket iovs from offset
+     */
+    static void
+    prepare_message(UdpSocket* sock,
+                    RtpBatch* batch,
+                    byte* headers,
+                    int first,
+                    int count,
+                    int index,
+                    int offset)
+    {
+        struct mmsghdr* msg = &sock->msgs[index];
+        memset(msg,0,sizeof(struct mmsghdr));
+
+        int bufs = 0;
+        for(int i = first; i < first + count; i++)
+            bufs += gather(batch, headers, i, sock->iovs + offset + bufs);
+
+        msg->msg_hdr.msg_iov    = sock->iovs + offset;
+        msg->msg_hdr.msg_iovlen = bufs;
+        sock->runs[index] = count;
+
+        if(count == 1)
+            return;
+
+        // kernel cut the gathered buffer every segment bytes, the last datagram may be shorter
+        msg->msg_hdr.msg_control    = sock->control[index];
+        msg->msg_hdr.msg_controllen = sizeof(sock->control[index]);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg->msg_hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type  = UDP_SEGMENT;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(unsigned short));
+        *(unsigned short*)CMSG_DATA(cmsg) = (unsigned short)batch->packets[first].size;
+    }
+
+    /**
+     * @brief
+     * up to UDP_BATCH_MAX messages per syscall, 
+     * return the number of packets sent.
+     * zerocopy is the number of messages sent with MSG_ZEROCOPY
+     */
+    static int
+    send_mmsg(UdpSocket* sock,
+              RtpBatch* batch,
+              byte* headers,
+              int flags,
+              int* zerocopy)
+    {
+        int sent = 0;
+        while(sent < batch->count) {
+            int count = 0;
+            int offset = 0;
+            for(int next = sent; count < UDP_BATCH_MAX && next < batch->count; count++) {
+                int bufs;
+                int run = run_length(sock, batch, next, &bufs);
+                if(offset + bufs > UDP_BATCH_BUFS)
+                    break;
+
+                prepare_message(sock, batch, headers, next, run, count, offset);
+                offset += bufs;
+                next   += run;
+            }
+
+            int ret = sendmmsg(sock->fd, sock->msgs, count, flags);
+            if(ret > 0) {
+                // the message that stopped the call report its error on the next one
+                for(int i = 0; i < ret; i++)
+                    sent += sock->runs[i];
+                if(flags & MSG_ZEROCOPY)
+                    *zerocopy += ret;
+                continue;
+            }
+
+            // out of option memory for pinned pages, copy the rest of the frame
+            if((flags & MSG_ZEROCOPY) && errno == ENOBUFS) {
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+
+            if(errno == ENOSYS) {
+                LOG_WARNING("sendmmsg is not supported, sending one datagram per call");
+                sock->mmsg = FALSE;
+                return send_each(sock, batch, headers, sent);
+            }
+
+            // no checksum offload on the route, or segment rejected: resend unsegmented
+            if(sock->gso && sock->runs[0] > 1 && (errno == EIO || errno == EINVAL)) {
+                LOG_WARNING("udp gso rejected by the kernel, sending one datagram per packet");
+                sock->gso = FALSE;
+                continue;
+            }
+
+            // messages are lost but the rest of the frame can still go out
+            if(refused()) {
+                sent += sock->runs[0];
+                continue;
+            }
+
+            LOG_ERROR("udp send failed");
+            return sent;
+        }
+        return sent;
+    }
+#endif
+
+    bool
+    udp_gso(UdpSocket* sock)
+    {
+        return sock->gso;
+    }
+
+    int
+    udp_send(UdpSocket* sock,
+             util::Buffer* buf,
+             pointer* headers)
+    {
+        RtpBatch* batch = (RtpBatch*)BUFFER_CLASS->ref(buf,NULL);
+        byte* header = (byte*)*headers;
+
+        int sent;
+#ifdef __linux__
+        zerocopy_reap(sock);
+
+        int bytes = 0;
+        for(int i = 0; i < batch->count; i++)
+            bytes += batch->packets[i].size;
+
+        bool zerocopy = sock->zerocopy && 
+                        bytes >= UDP_ZEROCOPY_MIN_BYTES &&
+                        sock->pending_count < UDP_ZEROCOPY_MAX_PENDING;
+
+        if(sock->mmsg) {
+            int messages = 0;
+            sent = send_mmsg(sock, batch, header, zerocopy ? MSG_ZEROCOPY : 0, &messages);
+
+            // kernel send from the frame until completion, the reference taken above is kept
+            if(messages) {
+                zerocopy_hold(sock, buf, *headers, messages);
+                *headers = NULL;
+                buf = NULL;
+            }
+        } else
+#endif
+#ifdef _WIN32
+        if(sock->gso)
+            sent = send_uso(sock, batch, header);
+        else
+#endif
+            sent = send_each(sock, batch, header, 0);
+
+        int count = batch->count;
+        if(buf)
+            BUFFER_CLASS->unref(buf);
+        return sent || !count ? sent : -1;
+    }
+
+    void
+    udp_close(UdpSocket* sock)
+    {
+        if(!sock)
+            return;
+
+#ifdef __linux__
+        zerocopy_drain(sock);
+#endif
+        close_socket(sock->fd);
+        free(sock);
+    }
+} // namespace rtp
@@ -0,0 +1,60 @@
+/**
+ * @file sunshine_udp.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __SUNSHINE_UDP_H__
+#define __SUNSHINE_UDP_H__
+
+#include <sunshine_util.h>
+#include <sunshine_packetizer.h>
+
+namespace rtp
+{
+    typedef struct _UdpSocket UdpSocket;
+
+    typedef enum _UdpFlags {
+        UDP_GSO         = 1 << 0,   // segmentation offload (linux UDP_SEGMENT, windows UDP_SEND_MSG_SIZE), ignored if unsupported
+        UDP_ZEROCOPY    = 1 << 1,   // send large frames from user pages (linux MSG_ZEROCOPY), ignored if unsupported and on windows
+    }UdpFlags;
+
+    /**
+     * @brief
+     * connected udp socket toward one receiver port,
+     * flags is a combination of UdpFlags
+     */
+    UdpSocket*      udp_open            (char* address,
+                                         int port,
+                                         int flags);
+
+    /**
+     * @brief
+     * send every packet of batch (util::Buffer of RtpBatch) in order, 
+     * with sendmmsg on linux, one send per datagram (or per offloaded run) on windows.
+     * headers is a pool block holding the rtp header of every packet, written by PACKETIZER_CLASS->stamp,
+     * each datagram is gathered from its header and the payload slices.
+     * with UDP_GSO a run of full size packets is handed to the kernel as a single message.
+     * with UDP_ZEROCOPY the socket may keep the frame until the kernel is done with it,
+     * it then take a reference on batch and the headers block, *headers is set to NULL.
+     * return the number of packets sent, lower than the batch count on a partial send,
+     * -1 if nothing could be sent
+     */
+    int             udp_send            (UdpSocket* sock,
+                                         util::Buffer* batch,
+                                         pointer* headers);
+
+    /**
+     * @brief
+     * segmentation offload is in use on this socket
+     */
+    bool            udp_gso             (UdpSocket* sock);
+
+    void            udp_close           (UdpSocket* sock);
+} // namespace rtp
+
+#endif
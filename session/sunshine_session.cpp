@@ -25,23 +25,60 @@ namespace session {
     init_session(Session* session)
     {
         session->shutdown_event = NEW_EVENT;
-        session->packet_queue = QUEUE_ARRAY_CLASS->init();
+        session->rendition_count = 1 + MIN(ENCODER_CONFIG->simulcast_count, SIMULCAST_MAX);
+        for(int i = 0; i < session->rendition_count; i++) {
+            session->packet_queue[i] = QUEUE_ARRAY_CLASS->init();
+            session->output[i] = rtp::make_rtp_output(session->packet_queue[i], 
+                                                      ENCODER_CONFIG->rtp.port + i * RTP_RENDITION_PORTS);
+            session->keyframe[i] = encoder::make_idr_request(ENCODER_CONFIG->idr_window);
+        }
     }
 
+    static void
+    request_keyframe(pointer data)
+    {
+        encoder::request_idr((encoder::IdrRequest*)data);
+    }
 
 
     void
     start_session(Session* session)
     {
+        int stalled = 0;
         std::thread capture   { encoder::capture, 
                                 session->shutdown_event, 
-                                session->packet_queue };
+                                session->output,
+                                session->keyframe,
+                                session->rendition_count,
+                                &stalled };
 
-        std::thread broadcast { rtp::start_broadcast , 
-                                session->shutdown_event, 
-                                session->packet_queue };
+        // one encode is delivered to every viewer of a rendition,
+        // viewer switch rendition by joining another fanout
+        std::thread broadcast[SIMULCAST_MAX + 1];
+        for(int i = 0; i < session->rendition_count; i++) {
+            int bitrate = i ? ENCODER_CONFIG->simulcast[i - 1].bitrate : ENCODER_CONFIG->conf.bitrate;
+            broadcast[i] = std::thread { rtp::start_broadcast, 
+                                         session->shutdown_event, 
+                                         session->output[i],
+                                         ENCODER_CONFIG->rtp.port + i * RTP_RENDITION_PORTS,
+                                         bitrate,
+                                         request_keyframe,
+                                         (pointer)session->keyframe[i] };
+        }
 
         WAIT_EVENT(session->shutdown_event);
-        
+
+        // viewers close their rtp contexts before the stream descriptions go away
+        capture.join();
+        for(int i = 0; i < session->rendition_count; i++) {
+            broadcast[i].join();
+
+            // a capture worker stuck in the driver may still reach the output, leak it
+            if(stalled)
+                continue;
+
+            rtp::free_rtp_output(session->output[i]);
+            session->output[i] = NULL;
+        }
     }
 }
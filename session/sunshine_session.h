@@ -15,6 +15,7 @@
 
 #include <sunshine_util.h>
 #include <sunshine_config.h>
+#include <encoder_idr.h>
 
 
 namespace session
@@ -23,7 +24,25 @@ namespace session
     {
         util::Broadcaster* shutdown_event;
 
-        util::QueueArray* packet_queue;
+        /**
+         * @brief 
+         * index 0 is the main stream, next ones are simulcast renditions
+         */
+        util::QueueArray* packet_queue[SIMULCAST_MAX + 1];
+
+        /**
+         * @brief 
+         * rtp output of each rendition, stream descriptions are kept per session
+         */
+        rtp::RtpOutput* output[SIMULCAST_MAX + 1];
+
+        /**
+         * @brief 
+         * raised by any viewer that need a keyframe, consumed by capture
+         */
+        encoder::IdrRequest* keyframe[SIMULCAST_MAX + 1];
+
+        int rendition_count;
     }Session;
     
 
@@ -0,0 +1,63 @@
+/**
+ * @file avcodec.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * the few libavcodec declarations the packetizer and the udp sender use,
+ * so that they build on hosts without ffmpeg
+ * @version 1.0
+ * @date 2022-08-06
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __STUB_AVCODEC_H__
+#define __STUB_AVCODEC_H__
+
+#include <stdint.h>
+
+#define AV_VERSION_INT(a, b, c) ((a) << 16 | (b) << 8 | (c))
+#define LIBAVCODEC_VERSION_INT  AV_VERSION_INT(58, 134, 100)
+
+#define AV_PKT_FLAG_KEY         0x0001
+
+enum AVCodecID {
+    AV_CODEC_ID_NONE,
+    AV_CODEC_ID_H264 = 27,
+    AV_CODEC_ID_HEVC = 173,
+};
+
+enum AVHWDeviceType {
+    AV_HWDEVICE_TYPE_NONE,
+};
+
+enum AVPixelFormat {
+    AV_PIX_FMT_NONE = -1,
+};
+
+typedef struct AVRational {
+    int num;
+    int den;
+} AVRational;
+
+typedef struct AVBufferRef AVBufferRef;
+typedef struct AVFrame AVFrame;
+typedef struct AVCodec AVCodec;
+typedef struct AVCodecContext AVCodecContext;
+
+typedef struct AVPacket {
+    AVBufferRef* buf;
+    int64_t pts;
+    int64_t dts;
+    uint8_t* data;
+    int size;
+    int stream_index;
+    int flags;
+} AVPacket;
+
+typedef struct AVCodecParameters {
+    enum AVCodecID codec_id;
+    uint8_t* extradata;
+    int extradata_size;
+} AVCodecParameters;
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file avformat.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-08-06
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __STUB_AVFORMAT_H__
+#define __STUB_AVFORMAT_H__
+
+#include <libavcodec/avcodec.h>
+
+typedef struct AVStream AVStream;
+typedef struct AVOutputFormat AVOutputFormat;
+typedef struct AVFormatContext AVFormatContext;
+
+#endif
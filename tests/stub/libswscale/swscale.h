@@ -0,0 +1,16 @@
+/**
+ * @file swscale.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-08-06
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __STUB_SWSCALE_H__
+#define __STUB_SWSCALE_H__
+
+typedef struct SwsContext SwsContext;
+
+#endif
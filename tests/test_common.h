@@ -0,0 +1,34 @@
+/**
+ * @file test_common.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-08-06
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __TEST_COMMON_H__
+#define __TEST_COMMON_H__
+
+#include <stdio.h>
+
+/**
+ * @brief 
+ * every test is a function returning 0 on success,
+ * a failed check print its location and leave the test
+ */
+#define CHECK(cond) do {                                                        \
+        if(!(cond)) {                                                           \
+            printf("%s : %d : check failed : %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                           \
+        }                                                                       \
+    } while(0)
+
+#define RUN_TEST(failed, test) do {                                             \
+        int ret = test();                                                       \
+        printf("%s : %s\n", #test, ret ? "failed" : "passed");                  \
+        failed += ret ? 1 : 0;                                                  \
+    } while(0)
+
+#endif
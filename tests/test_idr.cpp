@@ -0,0 +1,150 @@
+/**
+ * @file test_idr.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <encoder_idr.h>
+#include <encoder_cost.h>
+#include <test_common.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace std::literals;
+
+/**
+ * @brief
+ * requests made before the encoder take one share a single keyframe
+ */
+static int
+test_coalesce()
+{
+    encoder::IdrRequest* request = encoder::make_idr_request(0);
+    CHECK(!encoder::take_idr(request));
+
+    encoder::request_idr(request);
+    encoder::request_idr(request);
+    encoder::request_idr(request);
+    CHECK(encoder::idr_pending(request));
+    CHECK(encoder::take_idr(request));
+    CHECK(!encoder::take_idr(request));
+
+    encoder::IdrStats stats;
+    encoder::idr_stats(request, &stats);
+    CHECK(stats.requested == 3);
+    CHECK(stats.coalesced == 2);
+    CHECK(stats.issued == 1);
+
+    encoder::idr_request_finalize(request);
+    return 0;
+}
+
+/**
+ * @brief
+ * a request right after a keyframe is held until the window expire, not dropped
+ */
+static int
+test_window()
+{
+    encoder::IdrRequest* request = encoder::make_idr_request(100);
+
+    encoder::request_idr(request);
+    CHECK(encoder::take_idr(request));
+
+    encoder::request_idr(request);
+    CHECK(!encoder::idr_pending(request));
+    CHECK(!encoder::take_idr(request));
+
+    std::this_thread::sleep_for(150ms);
+    CHECK(encoder::idr_pending(request));
+    CHECK(encoder::take_idr(request));
+
+    encoder::IdrStats stats;
+    encoder::idr_stats(request, &stats);
+    CHECK(stats.requested == 2);
+    CHECK(stats.coalesced == 0);
+    CHECK(stats.issued == 2);
+
+    encoder::idr_request_finalize(request);
+    return 0;
+}
+
+/**
+ * @brief
+ * a keyframe the encoder made on its own restart the window
+ */
+static int
+test_natural_keyframe()
+{
+    encoder::IdrRequest* request = encoder::make_idr_request(100);
+
+    encoder::idr_keyframe_sent(request);
+    encoder::request_idr(request);
+    CHECK(!encoder::take_idr(request));
+
+    std::this_thread::sleep_for(150ms);
+    CHECK(encoder::take_idr(request));
+
+    encoder::idr_request_finalize(request);
+    return 0;
+}
+
+/**
+ * @brief
+ * warmup frames do not count, the first window is judged once
+ */
+static int
+test_cost_over_budget()
+{
+    encoder::CostMonitor monitor;
+    encoder::cost_monitor_reset(&monitor, 60);
+    int64 slow = monitor.budget * 2;
+    int64 fast = monitor.budget / 2;
+
+    for(int i = 0; i < COST_WARMUP_FRAMES; i++)
+        CHECK(!encoder::cost_monitor_add(&monitor, slow));
+
+    int over = COST_WINDOW_FRAMES * COST_OVER_PERCENT / 100;
+    for(int i = 0; i < COST_WINDOW_FRAMES - 1; i++)
+        CHECK(!encoder::cost_monitor_add(&monitor, i < over ? slow : fast));
+    CHECK(encoder::cost_monitor_add(&monitor, fast));
+
+    // decision is only taken before receivers decode the stream
+    for(int i = 0; i < COST_WINDOW_FRAMES * 2; i++)
+        CHECK(!encoder::cost_monitor_add(&monitor, slow));
+    return 0;
+}
+
+static int
+test_cost_within_budget()
+{
+    encoder::CostMonitor monitor;
+    encoder::cost_monitor_reset(&monitor, 60);
+    int64 slow = monitor.budget + 1;
+
+    for(int i = 0; i < COST_WARMUP_FRAMES; i++)
+        encoder::cost_monitor_add(&monitor, slow);
+
+    int over = COST_WINDOW_FRAMES * COST_OVER_PERCENT / 100 - 1;
+    for(int i = 0; i < COST_WINDOW_FRAMES; i++)
+        CHECK(!encoder::cost_monitor_add(&monitor, i < over ? slow : monitor.budget));
+    CHECK(monitor.judged);
+    return 0;
+}
+
+int
+main()
+{
+    int failed = 0;
+    RUN_TEST(failed, test_coalesce);
+    RUN_TEST(failed, test_window);
+    RUN_TEST(failed, test_natural_keyframe);
+    RUN_TEST(failed, test_cost_over_budget);
+    RUN_TEST(failed, test_cost_within_budget);
+    return failed;
+}
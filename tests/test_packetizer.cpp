@@ -0,0 +1,446 @@
+/**
+ * @file test_packetizer.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_util.h>
+#include <sunshine_packetizer.h>
+#include <test_common.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_MTU            1200
+
+// largest datagram of a test, header included
+#define TEST_DATAGRAM_MAX   2048
+
+// hevc nal unit types
+#define HEVC_TRAIL_R        1
+#define HEVC_IDR_W_RADL     19
+#define HEVC_VPS            32
+#define HEVC_SPS            33
+#define HEVC_PPS            34
+#define HEVC_AUD            35
+
+typedef struct _TestNal {
+    byte header[2];
+    int size;
+}TestNal;
+
+static void
+free_packet(pointer data)
+{
+    libav::Packet* packet = (libav::Packet*)data;
+    free(packet->data);
+    free(packet);
+}
+
+/**
+ * @brief
+ * nal payload byte at offset, so that reassembled data can be compared
+ */
+static byte
+nal_byte(int nal,
+         int offset)
+{
+    return (byte)(nal * 31 + offset * 7 + 1);
+}
+
+/**
+ * @brief
+ * annex-b stream of nals, 4 bytes start code then header then payload
+ */
+static int
+write_annexb(TestNal* nals,
+             int count,
+             int header,
+             byte* out)
+{
+    int size = 0;
+    for(int i = 0; i < count; i++) {
+        out[size++] = 0;
+        out[size++] = 0;
+        out[size++] = 0;
+        out[size++] = 1;
+        memcpy(out + size, nals[i].header, header);
+        for(int j = header; j < nals[i].size; j++)
+            out[size + j] = nal_byte(i, j);
+        size += nals[i].size;
+    }
+    return size;
+}
+
+static util::Buffer*
+make_packet(TestNal* nals,
+            int count,
+            int header)
+{
+    int size = 0;
+    for(int i = 0; i < count; i++)
+        size += 4 + nals[i].size;
+
+    libav::Packet* packet = (libav::Packet*)malloc(sizeof(libav::Packet));
+    memset(packet,0,sizeof(libav::Packet));
+    packet->data = (byte*)malloc(size);
+    packet->size = write_annexb(nals, count, header, packet->data);
+    return BUFFER_CLASS->init(packet, sizeof(libav::Packet), free_packet);
+}
+
+static libav::CodecParameters
+make_params(libav::CodecID codec,
+            byte* extradata,
+            int extradata_size)
+{
+    libav::CodecParameters params;
+    memset(&params,0,sizeof(params));
+    params.codec_id       = codec;
+    params.extradata      = extradata;
+    params.extradata_size = extradata_size;
+    return params;
+}
+
+/**
+ * @brief
+ * datagram i as the socket send it, header of headers then every slice
+ */
+static int
+datagram(rtp::RtpBatch* batch,
+         byte* headers,
+         int index,
+         byte* out)
+{
+    rtp::RtpPacket* packet = &batch->packets[index];
+    int size = RTP_HEADER_SIZE + packet->prefix_size;
+    memcpy(out, headers + index * RTP_PACKET_HEADER_MAX, size);
+    for(int i = 0; i < packet->slice_count; i++) {
+        memcpy(out + size, packet->slices[i].data, packet->slices[i].size);
+        size += packet->slices[i].size;
+    }
+    return size;
+}
+
+static rtp::RtpBatch*
+batch_of(util::Buffer* buf)
+{
+    rtp::RtpBatch* batch = (rtp::RtpBatch*)BUFFER_CLASS->ref(buf, NULL);
+    BUFFER_CLASS->unref(buf);
+    return batch;
+}
+
+/**
+ * @brief
+ * nal that fit in a packet go out alone, unmodified, with the marker set
+ */
+static int
+test_single_nal()
+{
+    TestNal nals[] = { { { 0x65 }, 300 } };
+    libav::CodecParameters params = make_params(AV_CODEC_ID_H264, NULL, 0);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+    CHECK(packetizer);
+
+    util::Buffer* packet = make_packet(nals, 1, 1);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    CHECK(buf);
+    rtp::RtpBatch* batch = batch_of(buf);
+    CHECK(batch->count == 1);
+    CHECK(batch->packets[0].prefix_size == 0);
+    CHECK(batch->packets[0].size == RTP_HEADER_SIZE + 300);
+
+    rtp::RtpSource source = { 0x11223344, 0, 7 };
+    byte headers[RTP_PACKET_HEADER_MAX];
+    PACKETIZER_CLASS->stamp(&source, batch, headers);
+
+    byte data[TEST_DATAGRAM_MAX];
+    CHECK(datagram(batch, headers, 0, data) == RTP_HEADER_SIZE + 300);
+    CHECK(data[1] == (0x80 | RTP_PAYLOAD_TYPE));
+    CHECK(data[RTP_HEADER_SIZE] == 0x65);
+    for(int i = 1; i < 300; i++)
+        CHECK(data[RTP_HEADER_SIZE + i] == nal_byte(0, i));
+
+    // payload is not copied
+    libav::Packet* av = batch->packet;
+    CHECK(batch->packets[0].slices[0].data == av->data + 4);
+
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+    PACKETIZER_CLASS->finalize(packetizer);
+    return 0;
+}
+
+/**
+ * @brief
+ * SPS and PPS share a STAP-A, the IDR slice is cut in FU-A fragments,
+ * start and end bits on the first and last fragment only
+ */
+static int
+test_h264_fragments()
+{
+    TestNal nals[] = {
+        { { 0x67 }, 12 },
+        { { 0x68 }, 5 },
+        { { 0x65 }, 3000 },
+    };
+    libav::CodecParameters params = make_params(AV_CODEC_ID_H264, NULL, 0);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+
+    util::Buffer* packet = make_packet(nals, 3, 1);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    rtp::RtpBatch* batch = batch_of(buf);
+
+    // fragment payload is the mtu minus rtp header and FU indicator and header
+    int fragment = TEST_MTU - RTP_HEADER_SIZE - 2;
+    int fragments = (3000 - 1 + fragment - 1) / fragment;
+    CHECK(batch->count == 1 + fragments);
+
+    rtp::RtpSource source = { 1, 0, 0 };
+    byte* headers = (byte*)malloc(batch->count * RTP_PACKET_HEADER_MAX);
+    PACKETIZER_CLASS->stamp(&source, batch, headers);
+
+    byte data[TEST_DATAGRAM_MAX];
+    int size = datagram(batch, headers, 0, data);
+    byte* stap = data + RTP_HEADER_SIZE;
+    CHECK(size == RTP_HEADER_SIZE + 1 + 2 + 12 + 2 + 5);
+    CHECK((stap[0] & 0x1F) == 24);
+    CHECK((stap[0] & 0x60) == 0x60);
+    CHECK(stap[1] == 0 && stap[2] == 12);
+    CHECK(stap[3] == 0x67);
+    CHECK(stap[3 + 12] == 0 && stap[4 + 12] == 5);
+    CHECK(stap[5 + 12] == 0x68);
+    CHECK(!(data[1] & 0x80));
+
+    // reassemble the IDR slice from its fragments
+    byte* idr = (byte*)malloc(3000);
+    int offset = 1;
+    for(int i = 1; i < batch->count; i++) {
+        size = datagram(batch, headers, i, data);
+        CHECK(size <= TEST_MTU);
+        if(i < batch->count - 1)
+            CHECK(size == TEST_MTU);
+
+        byte* fu = data + RTP_HEADER_SIZE;
+        CHECK(fu[0] == ((0x65 & 0xE0) | 28));
+        CHECK((fu[1] & 0x1F) == 5);
+        CHECK(!!(fu[1] & 0x80) == (i == 1));
+        CHECK(!!(fu[1] & 0x40) == (i == batch->count - 1));
+        CHECK(!!(data[1] & 0x80) == (i == batch->count - 1));
+
+        memcpy(idr + offset, fu + 2, size - RTP_HEADER_SIZE - 2);
+        offset += size - RTP_HEADER_SIZE - 2;
+    }
+    CHECK(offset == 3000);
+    for(int i = 1; i < 3000; i++)
+        CHECK(idr[i] == nal_byte(2, i));
+
+    free(idr);
+    free(headers);
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+    PACKETIZER_CLASS->finalize(packetizer);
+    return 0;
+}
+
+/**
+ * @brief
+ * a STAP-A never carry more than RTP_AGGREGATE_MAX nal units
+ */
+static int
+test_aggregate_limit()
+{
+    TestNal nals[RTP_AGGREGATE_MAX * 2 + 1];
+    for(int i = 0; i < RTP_AGGREGATE_MAX * 2 + 1; i++) {
+        nals[i].header[0] = 0x06;
+        nals[i].size      = 10;
+    }
+
+    libav::CodecParameters params = make_params(AV_CODEC_ID_H264, NULL, 0);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+    util::Buffer* packet = make_packet(nals, RTP_AGGREGATE_MAX * 2 + 1, 1);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    rtp::RtpBatch* batch = batch_of(buf);
+
+    CHECK(batch->count == 3);
+    CHECK(batch->packets[0].slice_count == 2 * RTP_AGGREGATE_MAX - 1);
+    CHECK(batch->packets[1].slice_count == 2 * RTP_AGGREGATE_MAX - 1);
+    CHECK(batch->packets[2].slice_count == 1);
+    CHECK(batch->packets[2].prefix_size == 0);
+    CHECK(batch->packets[2].marker);
+
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+    PACKETIZER_CLASS->finalize(packetizer);
+    return 0;
+}
+
+/**
+ * @brief
+ * every receiver get its own ssrc, timestamp offset and sequence numbers
+ * over the same batch, sequence continue from one frame to the next
+ */
+static int
+test_stamp()
+{
+    TestNal nals[] = { { { 0x65 }, 2500 } };
+    libav::CodecParameters params = make_params(AV_CODEC_ID_H264, NULL, 0);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+    util::Buffer* packet = make_packet(nals, 1, 1);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 3000);
+    rtp::RtpBatch* batch = batch_of(buf);
+    CHECK(batch->count == 3);
+
+    rtp::RtpSource first  = { 0xAABBCCDD, 100, 0xFFFF };
+    rtp::RtpSource second = { 0x01020304, 0, 10 };
+    byte a[3 * RTP_PACKET_HEADER_MAX];
+    byte b[3 * RTP_PACKET_HEADER_MAX];
+    PACKETIZER_CLASS->stamp(&first, batch, a);
+    PACKETIZER_CLASS->stamp(&second, batch, b);
+
+    // sequence wrap around
+    CHECK(a[2] == 0xFF && a[3] == 0xFF);
+    CHECK(a[RTP_PACKET_HEADER_MAX + 2] == 0 && a[RTP_PACKET_HEADER_MAX + 3] == 0);
+    CHECK(first.sequence == 2);
+    CHECK(second.sequence == 13);
+
+    CHECK(a[0] == 0x80);
+    CHECK(a[4] == 0 && a[5] == 0 && a[6] == (3100 >> 8) && a[7] == (3100 & 0xff));
+    CHECK(b[6] == (3000 >> 8) && b[7] == (3000 & 0xff));
+    CHECK(a[8] == 0xAA && a[11] == 0xDD);
+    CHECK(b[8] == 0x01 && b[11] == 0x04);
+
+    // prefix follow the header, same for every receiver
+    CHECK(!memcmp(a + RTP_HEADER_SIZE, b + RTP_HEADER_SIZE, 2));
+    CHECK(!memcmp(a + RTP_HEADER_SIZE, batch->packets[0].prefix, 2));
+
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+    PACKETIZER_CLASS->finalize(packetizer);
+    return 0;
+}
+
+/**
+ * @brief
+ * VPS/SPS/PPS of the extradata go in front of an IRAP frame, after the AUD,
+ * aggregated in one AP. fragments are FU with the slice type in the FU header
+ */
+static int
+test_hevc_parameter_sets()
+{
+    TestNal sets[] = {
+        { { HEVC_VPS << 1, 1 }, 20 },
+        { { HEVC_SPS << 1, 1 }, 40 },
+        { { HEVC_PPS << 1, 1 }, 8 },
+    };
+    byte extradata[256];
+    int extradata_size = write_annexb(sets, 3, 2, extradata);
+
+    libav::CodecParameters params = make_params(AV_CODEC_ID_HEVC, extradata, extradata_size);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+
+    // extradata is kept by the packetizer
+    memset(extradata, 0, sizeof(extradata));
+
+    TestNal nals[] = {
+        { { HEVC_AUD << 1, 1 }, 3 },
+        { { HEVC_IDR_W_RADL << 1, 1 }, 2000 },
+    };
+    util::Buffer* packet = make_packet(nals, 2, 2);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    rtp::RtpBatch* batch = batch_of(buf);
+    CHECK(batch->extradata);
+    CHECK(batch->count == 3);
+
+    rtp::RtpSource source = { 1, 0, 0 };
+    byte headers[3 * RTP_PACKET_HEADER_MAX];
+    PACKETIZER_CLASS->stamp(&source, batch, headers);
+
+    byte data[TEST_DATAGRAM_MAX];
+    int size = datagram(batch, headers, 0, data);
+    byte* ap = data + RTP_HEADER_SIZE;
+    CHECK(size == RTP_HEADER_SIZE + 2 + (2 + 3) + (2 + 20) + (2 + 40) + (2 + 8));
+    CHECK(((ap[0] >> 1) & 0x3F) == 48);
+    CHECK(ap[2] == 0 && ap[3] == 3);
+    CHECK(((ap[4] >> 1) & 0x3F) == HEVC_AUD);
+    CHECK(((ap[4 + 3 + 2] >> 1) & 0x3F) == HEVC_VPS);
+    CHECK(ap[4 + 3 + 2 + 2] == nal_byte(0, 2));
+
+    for(int i = 1; i < 3; i++) {
+        datagram(batch, headers, i, data);
+        byte* fu = data + RTP_HEADER_SIZE;
+        CHECK(((fu[0] >> 1) & 0x3F) == 49);
+        CHECK(fu[1] == 1);
+        CHECK((fu[2] & 0x3F) == HEVC_IDR_W_RADL);
+        CHECK(!!(fu[2] & 0x80) == (i == 1));
+        CHECK(!!(fu[2] & 0x40) == (i == 2));
+    }
+
+    // batch keep working once the packetizer is gone
+    PACKETIZER_CLASS->finalize(packetizer);
+    datagram(batch, headers, 0, data);
+    CHECK(((data[RTP_HEADER_SIZE + 4 + 3 + 2] >> 1) & 0x3F) == HEVC_VPS);
+
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+    return 0;
+}
+
+/**
+ * @brief
+ * frames that are not IRAP, or carry their own VPS, are left alone
+ */
+static int
+test_hevc_no_parameter_sets()
+{
+    TestNal sets[] = {
+        { { HEVC_VPS << 1, 1 }, 20 },
+        { { HEVC_SPS << 1, 1 }, 40 },
+        { { HEVC_PPS << 1, 1 }, 8 },
+    };
+    byte extradata[256];
+    int extradata_size = write_annexb(sets, 3, 2, extradata);
+    libav::CodecParameters params = make_params(AV_CODEC_ID_HEVC, extradata, extradata_size);
+    rtp::Packetizer* packetizer = PACKETIZER_CLASS->init(&params, TEST_MTU);
+
+    TestNal nals[] = { { { HEVC_TRAIL_R << 1, 1 }, 500 } };
+    util::Buffer* packet = make_packet(nals, 1, 2);
+    util::Buffer* buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    rtp::RtpBatch* batch = batch_of(buf);
+    CHECK(!batch->extradata);
+    CHECK(batch->count == 1);
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+
+    TestNal keyframe[] = {
+        { { HEVC_VPS << 1, 1 }, 20 },
+        { { HEVC_IDR_W_RADL << 1, 1 }, 500 },
+    };
+    packet = make_packet(keyframe, 2, 2);
+    buf = PACKETIZER_CLASS->packetize(packetizer, packet, 0);
+    batch = batch_of(buf);
+    CHECK(!batch->extradata);
+    CHECK(batch->count == 1);
+    CHECK(batch->packets[0].slice_count == 3);
+    BUFFER_CLASS->unref(buf);
+    BUFFER_CLASS->unref(packet);
+
+    PACKETIZER_CLASS->finalize(packetizer);
+    return 0;
+}
+
+int
+main()
+{
+    int failed = 0;
+    RUN_TEST(failed, test_single_nal);
+    RUN_TEST(failed, test_h264_fragments);
+    RUN_TEST(failed, test_aggregate_limit);
+    RUN_TEST(failed, test_stamp);
+    RUN_TEST(failed, test_hevc_parameter_sets);
+    RUN_TEST(failed, test_hevc_no_parameter_sets);
+    return failed;
+}
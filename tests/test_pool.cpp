@@ -0,0 +1,135 @@
+/**
+ * @file test_pool.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-07-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_util.h>
+#include <test_common.h>
+
+#include <cstddef>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief
+ * payload keep the malloc alignment, capacity is at least the block size,
+ * a larger request get a block of exactly its size
+ */
+static int
+test_layout()
+{
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(4096, 4);
+
+    byte* small = (byte*)BUFFER_POOL_CLASS->acquire(pool, 100);
+    byte* large = (byte*)BUFFER_POOL_CLASS->acquire(pool, 10000);
+    CHECK(small && large);
+    CHECK((uintptr_t)small % alignof(std::max_align_t) == 0);
+    CHECK((uintptr_t)large % alignof(std::max_align_t) == 0);
+    CHECK(BUFFER_POOL_CLASS->capacity(small) == 4096);
+    CHECK(BUFFER_POOL_CLASS->capacity(large) == 10000);
+
+    // whole capacity is writable
+    memset(small, 0xAB, 4096);
+    memset(large, 0xCD, 10000);
+
+    BUFFER_POOL_CLASS->release(small);
+    BUFFER_POOL_CLASS->release(large);
+    BUFFER_POOL_CLASS->finalize(pool);
+    return 0;
+}
+
+/**
+ * @brief
+ * released block is handed out again,
+ * a free block too small for the request is skipped
+ */
+static int
+test_recycle()
+{
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(1024, 4);
+
+    pointer first = BUFFER_POOL_CLASS->acquire(pool, 512);
+    BUFFER_POOL_CLASS->release(first);
+    CHECK(BUFFER_POOL_CLASS->acquire(pool, 1024) == first);
+
+    pointer large = BUFFER_POOL_CLASS->acquire(pool, 8192);
+    BUFFER_POOL_CLASS->release(first);
+    BUFFER_POOL_CLASS->release(large);
+
+    // free list is [large, first]
+    CHECK(BUFFER_POOL_CLASS->acquire(pool, 8000) == large);
+    CHECK(BUFFER_POOL_CLASS->acquire(pool, 100) == first);
+
+    BUFFER_POOL_CLASS->release(first);
+    BUFFER_POOL_CLASS->release(large);
+    BUFFER_POOL_CLASS->finalize(pool);
+    return 0;
+}
+
+/**
+ * @brief
+ * block wrapped in a util::Buffer go back to the pool on the last unref only
+ */
+static int
+test_refcount()
+{
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(1024, 4);
+
+    pointer payload = BUFFER_POOL_CLASS->acquire(pool, 1024);
+    util::Buffer* buf = BUFFER_CLASS->init(payload, 1024, BUFFER_POOL_CLASS->release);
+
+    int size;
+    CHECK(BUFFER_CLASS->ref(buf, &size) == payload);
+    CHECK(size == 1024);
+
+    BUFFER_CLASS->unref(buf);
+    pointer other = BUFFER_POOL_CLASS->acquire(pool, 1024);
+    CHECK(other != payload);
+    BUFFER_POOL_CLASS->release(other);
+
+    // last released is the first handed out
+    BUFFER_CLASS->unref(buf);
+    other = BUFFER_POOL_CLASS->acquire(pool, 1024);
+    CHECK(other == payload);
+    BUFFER_POOL_CLASS->release(other);
+
+    BUFFER_POOL_CLASS->finalize(pool);
+    return 0;
+}
+
+/**
+ * @brief
+ * block still in use when the pool is finalized stay valid,
+ * the pool is freed by its release
+ */
+static int
+test_finalize_outstanding()
+{
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(256, 4);
+
+    byte* kept = (byte*)BUFFER_POOL_CLASS->acquire(pool, 256);
+    pointer recycled = BUFFER_POOL_CLASS->acquire(pool, 256);
+    BUFFER_POOL_CLASS->release(recycled);
+    BUFFER_POOL_CLASS->finalize(pool);
+
+    memset(kept, 0x11, 256);
+    CHECK(BUFFER_POOL_CLASS->capacity(kept) == 256);
+    BUFFER_POOL_CLASS->release(kept);
+    return 0;
+}
+
+int
+main()
+{
+    int failed = 0;
+    RUN_TEST(failed, test_layout);
+    RUN_TEST(failed, test_recycle);
+    RUN_TEST(failed, test_refcount);
+    RUN_TEST(failed, test_finalize_outstanding);
+    return failed;
+}
@@ -0,0 +1,353 @@
+/**
+ * @file test_udp.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_util.h>
+#include <sunshine_udp.h>
+#include <test_common.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// full size packet of the offload tests, header included
+#define TEST_SEGMENT        1200
+
+// largest datagram of a test, header included
+#define TEST_DATAGRAM_MAX   2048
+
+// receive timeout, a missing datagram end the test
+#define TEST_TIMEOUT_MS     1000
+
+typedef struct _TestFrame {
+    rtp::RtpBatch batch;
+    byte* payload;
+    bool* freed;
+}TestFrame;
+
+static void
+free_frame(pointer data)
+{
+    TestFrame* frame = (TestFrame*)data;
+    if(frame->freed)
+        *frame->freed = TRUE;
+    free(frame->batch.packets);
+    free(frame->payload);
+    free(frame);
+}
+
+static byte
+payload_byte(int offset)
+{
+    return (byte)(offset * 7 + 1);
+}
+
+/**
+ * @brief
+ * frame of count packets with sizes[i] payload bytes,
+ * payload of every packet is split in two slices to exercise the gather path
+ */
+static util::Buffer*
+make_frame(int* sizes,
+           int count,
+           bool* freed)
+{
+    int total = 0;
+    for(int i = 0; i < count; i++)
+        total += sizes[i];
+
+    TestFrame* frame = (TestFrame*)malloc(sizeof(TestFrame));
+    memset(frame,0,sizeof(TestFrame));
+    frame->freed   = freed;
+    frame->payload = (byte*)malloc(total);
+    for(int i = 0; i < total; i++)
+        frame->payload[i] = payload_byte(i);
+
+    frame->batch.packets = (rtp::RtpPacket*)malloc(count * sizeof(rtp::RtpPacket));
+    memset(frame->batch.packets,0,count * sizeof(rtp::RtpPacket));
+    frame->batch.count = count;
+
+    int offset = 0;
+    for(int i = 0; i < count; i++) {
+        rtp::RtpPacket* packet = &frame->batch.packets[i];
+        int half = sizes[i] / 2;
+        packet->slices[0].data = frame->payload + offset;
+        packet->slices[0].size = half;
+        packet->slices[1].data = frame->payload + offset + half;
+        packet->slices[1].size = sizes[i] - half;
+        packet->slice_count = 2;
+        packet->size = RTP_HEADER_SIZE + sizes[i];
+        offset += sizes[i];
+    }
+
+    if(freed)
+        *freed = FALSE;
+    return BUFFER_CLASS->init(frame, sizeof(TestFrame), free_frame);
+}
+
+/**
+ * @brief
+ * header of packet i only carry its index, enough to check the order
+ */
+static pointer
+make_headers(util::BufferPool* pool,
+             int count)
+{
+    byte* headers = (byte*)BUFFER_POOL_CLASS->acquire(pool, count * RTP_PACKET_HEADER_MAX);
+    memset(headers,0,count * RTP_PACKET_HEADER_MAX);
+    for(int i = 0; i < count; i++) {
+        headers[i * RTP_PACKET_HEADER_MAX + 0] = (byte)(i >> 8);
+        headers[i * RTP_PACKET_HEADER_MAX + 1] = (byte)i;
+    }
+    return headers;
+}
+
+/**
+ * @brief
+ * loopback receiver, its port is written to port
+ */
+static int
+open_receiver(int* port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0)
+        return -1;
+
+    // a whole test frame is queued before it is read
+    int size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = TEST_TIMEOUT_MS * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+       getsockname(fd, (struct sockaddr*)&addr, &len)) {
+        close(fd);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * @brief
+ * every packet arrive as its own datagram, in order, with its header and payload
+ */
+static int
+receive_frame(int fd,
+              int* sizes,
+              int count)
+{
+    byte datagram[TEST_DATAGRAM_MAX];
+    int offset = 0;
+    for(int i = 0; i < count; i++) {
+        int size = (int)recv(fd, datagram, sizeof(datagram), 0);
+        CHECK(size == RTP_HEADER_SIZE + sizes[i]);
+        CHECK(datagram[0] == (byte)(i >> 8) && datagram[1] == (byte)i);
+        for(int j = 0; j < sizes[i]; j++)
+            CHECK(datagram[RTP_HEADER_SIZE + j] == payload_byte(offset + j));
+        offset += sizes[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ * send a frame of count packets through a socket opened with flags
+ * and check what the receiver got.
+ * freed is set once the socket and the test released the frame
+ */
+static int
+send_frame(int* sizes,
+           int count,
+           int flags,
+           bool* freed)
+{
+    int port;
+    int fd = open_receiver(&port);
+    CHECK(fd >= 0);
+
+    rtp::UdpSocket* sock = rtp::udp_open((char*)"127.0.0.1", port, flags);
+    CHECK(sock);
+
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(RTP_PACKET_HEADER_MAX, 4);
+    util::Buffer* frame = make_frame(sizes, count, freed);
+    pointer headers = make_headers(pool, count);
+
+    CHECK(rtp::udp_send(sock, frame, &headers) == count);
+    BUFFER_POOL_CLASS->release(headers);
+    BUFFER_CLASS->unref(frame);
+
+    int ret = receive_frame(fd, sizes, count);
+    rtp::udp_close(sock);
+    BUFFER_POOL_CLASS->finalize(pool);
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief
+ * frame larger than one sendmmsg call go out completely and in order
+ */
+static int
+test_batch()
+{
+    // small packets, the whole frame fit the default receive buffer
+    int sizes[300];
+    for(int i = 0; i < 300; i++)
+        sizes[i] = 200;
+    sizes[299] = 50;
+
+    bool freed;
+    CHECK(!send_frame(sizes, 300, 0, &freed));
+    CHECK(freed);
+    return 0;
+}
+
+/**
+ * @brief
+ * with segmentation offload every packet still arrive as its own datagram,
+ * a shorter packet end a run and the next run start after it.
+ * without kernel support the socket fall back to one datagram per packet
+ */
+static int
+test_gso()
+{
+    int sizes[100];
+    for(int i = 0; i < 100; i++)
+        sizes[i] = TEST_SEGMENT - RTP_HEADER_SIZE;
+    sizes[40] = 500;
+    sizes[99] = 300;
+
+    int port;
+    int fd = open_receiver(&port);
+    CHECK(fd >= 0);
+
+    rtp::UdpSocket* sock = rtp::udp_open((char*)"127.0.0.1", port, rtp::UDP_GSO);
+    CHECK(sock);
+    bool gso = rtp::udp_gso(sock);
+    printf("udp gso %s\n", gso ? "enabled" : "not supported");
+
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(RTP_PACKET_HEADER_MAX, 4);
+    util::Buffer* frame = make_frame(sizes, 100, NULL);
+    pointer headers = make_headers(pool, 100);
+    CHECK(rtp::udp_send(sock, frame, &headers) == 100);
+    BUFFER_POOL_CLASS->release(headers);
+    BUFFER_CLASS->unref(frame);
+
+    // loopback accept segmented sends, offload must not have been dropped
+    CHECK(rtp::udp_gso(sock) == gso);
+    CHECK(!receive_frame(fd, sizes, 100));
+
+    rtp::udp_close(sock);
+    BUFFER_POOL_CLASS->finalize(pool);
+    close(fd);
+    return 0;
+}
+
+/**
+ * @brief
+ * frame sent with MSG_ZEROCOPY is kept by the socket, with its headers block, 
+ * until the kernel completed it, and is released at the latest on close.
+ * loopback always copy, the second frame check the fallback
+ */
+static int
+test_zerocopy()
+{
+    int sizes[60];
+    for(int i = 0; i < 60; i++)
+        sizes[i] = TEST_SEGMENT - RTP_HEADER_SIZE;
+
+    int port;
+    int fd = open_receiver(&port);
+    CHECK(fd >= 0);
+
+    rtp::UdpSocket* sock = rtp::udp_open((char*)"127.0.0.1", port, rtp::UDP_ZEROCOPY);
+    CHECK(sock);
+
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(RTP_PACKET_HEADER_MAX, 4);
+    bool freed[2];
+    bool held[2];
+    for(int i = 0; i < 2; i++) {
+        util::Buffer* frame = make_frame(sizes, 60, &freed[i]);
+        pointer headers = make_headers(pool, 60);
+        CHECK(rtp::udp_send(sock, frame, &headers) == 60);
+
+        // socket took the headers block, the frame is still referenced
+        held[i] = !headers;
+        BUFFER_POOL_CLASS->release(headers);
+        BUFFER_CLASS->unref(frame);
+        CHECK(freed[i] == !held[i]);
+        CHECK(!receive_frame(fd, sizes, 60));
+    }
+    printf("udp zerocopy held %d of 2 frames\n", held[0] + held[1]);
+
+    rtp::udp_close(sock);
+    CHECK(freed[0] && freed[1]);
+
+    BUFFER_POOL_CLASS->finalize(pool);
+    close(fd);
+    return 0;
+}
+
+/**
+ * @brief
+ * receiver not listening yet does not fail the frame
+ */
+static int
+test_refused()
+{
+    int port;
+    int fd = open_receiver(&port);
+    CHECK(fd >= 0);
+    close(fd);
+
+    rtp::UdpSocket* sock = rtp::udp_open((char*)"127.0.0.1", port, 0);
+    CHECK(sock);
+
+    int sizes[4] = { 100, 100, 100, 100 };
+    util::BufferPool* pool = BUFFER_POOL_CLASS->init(RTP_PACKET_HEADER_MAX, 4);
+    for(int i = 0; i < 3; i++) {
+        util::Buffer* frame = make_frame(sizes, 4, NULL);
+        pointer headers = make_headers(pool, 4);
+        CHECK(rtp::udp_send(sock, frame, &headers) == 4);
+        BUFFER_POOL_CLASS->release(headers);
+        BUFFER_CLASS->unref(frame);
+        usleep(10 * 1000);
+    }
+
+    rtp::udp_close(sock);
+    BUFFER_POOL_CLASS->finalize(pool);
+    return 0;
+}
+
+int
+main()
+{
+    int failed = 0;
+    RUN_TEST(failed, test_batch);
+    RUN_TEST(failed, test_gso);
+    RUN_TEST(failed, test_zerocopy);
+    RUN_TEST(failed, test_refused);
+    return failed;
+}
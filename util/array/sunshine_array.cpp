@@ -148,14 +148,14 @@ namespace util
                       char* key, 
                       char* val)
     {
+        // pairs are zero terminated, fill the first empty slot
         int i = 0;
         while ((pair + i)->type)
-        {
-            (pair + i)->type = Type::INT;
-            (pair + i)->key  = key;
-            (pair + i)->string_value = val;
             i++;
-        }
+
+        (pair + i)->type = Type::STRING;
+        (pair + i)->key  = key;
+        (pair + i)->string_value = val;
     }
 
     void
@@ -165,21 +165,11 @@ namespace util
     {
         int i = 0;
         while ((pair + i)->type)
-        {
-            (pair + i)->type = Type::INT;
-
-
-
-
-            (pair + i)->key = key;
-
-
-
-
-
-            (pair + i)->int_value = val;
             i++;
-        }
+
+        (pair + i)->type = Type::INT;
+        (pair + i)->key = key;
+        (pair + i)->int_value = val;
     }
 } // namespace util
 
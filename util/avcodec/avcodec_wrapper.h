@@ -15,8 +15,12 @@
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
 }
 
+// AVCodecContext::get_encode_buffer and AV_CODEC_CAP_DR1 for encoders
+#define LIBAV_HAS_ENCODE_BUFFER (LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 133, 100))
+
 
 
 namespace libav
@@ -36,6 +40,9 @@ namespace libav
     typedef AVCodec             Codec;
     typedef AVCodecID           CodecID;
     typedef AVCodecContext      CodecContext;
+    typedef AVCodecParameters   CodecParameters;
+
+    typedef SwsContext          ScaleContext;
 
     typedef AVOutputFormat      OutputFormat;
     typedef AVFormatContext     FormatContext;
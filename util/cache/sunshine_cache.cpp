@@ -0,0 +1,115 @@
+/**
+ * @file sunshine_cache.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#include <sunshine_cache.h>
+#include <sunshine_macro.h>
+
+#include <cstdio>
+#include <string.h>
+#include <mutex>
+
+namespace util
+{
+    static std::mutex cache_lock;
+
+    /**
+     * @brief 
+     * split line in place, return value part or NULL if line is not an entry
+     */
+    static char*
+    cache_split(char* line)
+    {
+        char* tab = strchr(line,'\t');
+        if(!tab)
+            return NULL;
+
+        *tab = 0;
+        char* value = tab + 1;
+        char* end = value + strlen(value);
+        while (end > value && (*(end - 1) == '\n' || *(end - 1) == '\r')) 
+            *(--end) = 0;
+
+        return value;
+    }
+
+    bool
+    cache_get(char* path,
+              char* key,
+              char* value,
+              int size)
+    {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        if(!path)
+            return false;
+
+        FILE* file = fopen(path,"r");
+        if(!file)
+            return false;
+
+        bool found = false;
+        char line[CACHE_MAX_LINE];
+        while (fgets(line,sizeof(line),file)) {
+            char* val = cache_split(line);
+            if(!val || strcmp(line,key))
+                continue;
+
+            snprintf(value,size,"%s",val);
+            found = true;
+            break;
+        }
+
+        fclose(file);
+        return found;
+    }
+
+    bool
+    cache_set(char* path,
+              char* key,
+              char* value)
+    {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        if(!path)
+            return false;
+
+        char tmp_path[CACHE_MAX_LINE];
+        snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",path);
+
+        FILE* out = fopen(tmp_path,"w");
+        if(!out) {
+            LOG_WARNING("unable to write cache file");
+            return false;
+        }
+
+        // copy every other entry, drop the stale one
+        FILE* in = fopen(path,"r");
+        if(in) {
+            char line[CACHE_MAX_LINE];
+            while (fgets(line,sizeof(line),in)) {
+                char* val = cache_split(line);
+                if(!val || !strcmp(line,key))
+                    continue;
+
+                fprintf(out,"%s\t%s\n",line,val);
+            }
+            fclose(in);
+        }
+
+        fprintf(out,"%s\t%s\n",key,value);
+        fclose(out);
+
+        // rename does not overwrite on windows
+        remove(path);
+        if(rename(tmp_path,path)) {
+            LOG_WARNING("unable to replace cache file");
+            return false;
+        }
+        return true;
+    }
+} // namespace util
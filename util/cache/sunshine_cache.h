@@ -0,0 +1,41 @@
+/**
+ * @file sunshine_cache.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief 
+ * @version 1.0
+ * @date 2022-07-29
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+#ifndef __SUNSHINE_CACHE_H__
+#define __SUNSHINE_CACHE_H__
+
+#include <sunshine_datatype.h>
+
+#define CACHE_MAX_LINE      1024
+
+namespace util
+{
+    /**
+     * @brief 
+     * small persistent key/value store, one "key\tvalue" entry per line.
+     * key and value must not contain tab or newline
+     * 
+     * @return true if key is found, value is filled
+     */
+    bool        cache_get       (char* path,
+                                 char* key,
+                                 char* value,
+                                 int size);
+
+    /**
+     * @brief 
+     * insert or replace key, file is rewritten through a temporary file
+     */
+    bool        cache_set       (char* path,
+                                 char* key,
+                                 char* value);
+} // namespace util
+
+#endif
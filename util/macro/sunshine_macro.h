@@ -24,8 +24,19 @@
 
 #define LOG_OUTPUT_PIPE(content) printf(content)
 
+// windows headers define them too, other hosts only get them from here
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
 #define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+
 #define DO_NOTHING do_nothing
 
 void do_nothing(void*);
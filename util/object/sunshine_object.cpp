@@ -15,11 +15,18 @@
 #include <cstdlib>
 #include <string.h>
 #include <mutex>
+#include <atomic>
+#include <new>
 
 namespace util 
 {
     typedef struct _Buffer{
-        uint ref_count;
+        /**
+         * @brief 
+         * buffer may be shared between threads (packet fanout),
+         * every thread ref and unref it without a common lock
+         */
+        std::atomic<uint> ref_count;
 
         /**
          * @brief 
@@ -46,11 +53,11 @@ namespace util
     object_duplicate (Buffer* obj)
     {
         Buffer* object = (Buffer*)malloc(sizeof(Buffer));
-        memset(object,0,sizeof(Buffer));
+        memset((pointer)object,0,sizeof(Buffer));
 
         memcpy(object->data,obj->data,obj->size);
-        memcpy(object,obj,sizeof(Buffer));
-        object->ref_count = 1;
+        memcpy((pointer)object,(pointer)obj,sizeof(Buffer));
+        new (&object->ref_count) std::atomic<uint>(1);
         return object;
     }
 
@@ -58,7 +65,7 @@ namespace util
     object_ref (Buffer* obj,
                 int* size)
     {
-        obj->ref_count++;
+        obj->ref_count.fetch_add(1, std::memory_order_relaxed);
         if (size)
             *size = obj->size;
         
@@ -85,10 +92,11 @@ namespace util
     void    
     object_unref (Buffer* obj)
     {
-        obj->ref_count--;
-        if (!obj->ref_count)
+        // last owner must see every write done by the others before freeing
+        if (obj->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
             obj->free_func(obj->data);
+            obj->ref_count.~atomic();
             free(obj);
         }
     }
@@ -100,12 +108,12 @@ namespace util
                  BufferFreeFunc free_func)
     {
         Buffer* object = (Buffer*)malloc(sizeof(Buffer));
-        memset(object,0,sizeof(Buffer));
+        memset((pointer)object,0,sizeof(Buffer));
+        new (&object->ref_count) std::atomic<uint>(1);
 
         object->data = data;
         object->free_func = free_func;
-        object->size = size,
-        object->ref_count = 1;
+        object->size = size;
         return object;
     }
 
@@ -0,0 +1,203 @@
+/**
+ * @file sunshine_pool.cpp
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-07-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <sunshine_pool.h>
+#include <sunshine_macro.h>
+#include <cstdlib>
+#include <string.h>
+#include <mutex>
+#include <new>
+
+#define POOL_ALIGN 64
+
+namespace util
+{
+    typedef struct _PoolBlock PoolBlock;
+
+    struct _PoolBlock {
+        BufferPool* pool;
+
+        PoolBlock* next;
+
+        uint capacity;
+    };
+
+    struct _BufferPool {
+        std::mutex lock;
+
+        PoolBlock* free_list;
+
+        uint block_size;
+
+        int free_count;
+        int max_free;
+
+        /**
+         * @brief
+         * number of block currently owned by the encoder or the sender
+         */
+        int outstanding;
+
+        bool closed;
+    };
+
+    /**
+     * @brief
+     * header size is padded so that payload start stay aligned
+     */
+    static uint
+    block_header_size()
+    {
+        return (sizeof(PoolBlock) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    }
+
+    static PoolBlock*
+    block_from_payload(pointer payload)
+    {
+        return (PoolBlock*)((byte*)payload - block_header_size());
+    }
+
+    static pointer
+    payload_from_block(PoolBlock* block)
+    {
+        return (byte*)block + block_header_size();
+    }
+
+    static void
+    pool_free(BufferPool* pool)
+    {
+        PoolBlock* block = pool->free_list;
+        while (block) {
+            PoolBlock* next = block->next;
+            free(block);
+            block = next;
+        }
+        pool->lock.~mutex();
+        free(pool);
+    }
+
+    BufferPool*
+    buffer_pool_init(uint block_size,
+                     int max_free)
+    {
+        BufferPool* pool = (BufferPool*)malloc(sizeof(BufferPool));
+        memset((pointer)pool,0,sizeof(BufferPool));
+        new (&pool->lock) std::mutex();
+
+        pool->block_size = block_size;
+        pool->max_free   = max_free;
+        return pool;
+    }
+
+    pointer
+    buffer_pool_acquire(BufferPool* pool,
+                        uint size)
+    {
+        PoolBlock* block = NULL;
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            PoolBlock** prev = &pool->free_list;
+            while (*prev) {
+                if((*prev)->capacity >= size) {
+                    block = *prev;
+                    *prev = block->next;
+                    pool->free_count--;
+                    break;
+                }
+                prev = &(*prev)->next;
+            }
+            pool->outstanding++;
+        }
+
+        if(!block) {
+            // keyframe may be larger than block_size, allocate exactly what is needed
+            uint capacity = MAX(size,pool->block_size);
+            block = (PoolBlock*)malloc(block_header_size() + capacity);
+            if(!block) {
+                std::lock_guard<std::mutex> guard(pool->lock);
+                pool->outstanding--;
+                return NULL;
+            }
+            block->pool     = pool;
+            block->capacity = capacity;
+        }
+
+        block->next = NULL;
+        return payload_from_block(block);
+    }
+
+    void
+    buffer_pool_release(pointer payload)
+    {
+        if(!payload)
+            return;
+
+        PoolBlock* block = block_from_payload(payload);
+        BufferPool* pool = block->pool;
+
+        bool destroy = false;
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool->outstanding--;
+
+            if(!pool->closed && pool->free_count < pool->max_free) {
+                block->next     = pool->free_list;
+                pool->free_list = block;
+                pool->free_count++;
+                block = NULL;
+            }
+
+            destroy = pool->closed && !pool->outstanding;
+        }
+
+        if(block)
+            free(block);
+        if(destroy)
+            pool_free(pool);
+    }
+
+    uint
+    buffer_pool_capacity(pointer payload)
+    {
+        return block_from_payload(payload)->capacity;
+    }
+
+    void
+    buffer_pool_finalize(BufferPool* pool)
+    {
+        bool destroy = false;
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool->closed = true;
+            destroy = !pool->outstanding;
+        }
+
+        // packets still in flight keep the pool alive until they are released
+        if(destroy)
+            pool_free(pool);
+    }
+
+    BufferPoolClass*
+    buffer_pool_class_init()
+    {
+        static bool initialized = false;
+        static BufferPoolClass klass = {0};
+        if (initialized)
+            return &klass;
+
+        klass.init     = buffer_pool_init;
+        klass.acquire  = buffer_pool_acquire;
+        klass.release  = buffer_pool_release;
+        klass.capacity = buffer_pool_capacity;
+        klass.finalize = buffer_pool_finalize;
+        initialized = true;
+        return &klass;
+    }
+} // namespace util
@@ -0,0 +1,59 @@
+/**
+ * @file sunshine_pool.h
+ * @author {Do Huy Hoang} ({huyhoangdo0205@gmail.com})
+ * @brief
+ * @version 1.0
+ * @date 2022-07-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#ifndef __SUNSHINE_POOL_H__
+#define __SUNSHINE_POOL_H__
+
+#include <sunshine_datatype.h>
+#include <sunshine_object.h>
+
+#define BUFFER_POOL_CLASS       util::buffer_pool_class_init()
+
+namespace util
+{
+    typedef struct _BufferPool BufferPool;
+
+    /**
+     * @brief
+     * |--header--|----------------payload----------------|
+     *            ^ pointer returned by acquire
+     * header is padded so that payload keep the alignment of malloc, it lead back to the block and its pool
+     */
+    typedef struct _BufferPoolClass {
+        BufferPool*     (*init)         (uint block_size,
+                                         int max_free);
+
+        /**
+         * @brief
+         * return a payload pointer with at least size bytes,
+         * block is recycled when release is called
+         */
+        pointer         (*acquire)      (BufferPool* pool,
+                                         uint size);
+
+        /**
+         * @brief
+         * match BufferFreeFunc so that payload can be wrapped by BUFFER_CLASS->init
+         */
+        void            (*release)      (pointer payload);
+
+        uint            (*capacity)     (pointer payload);
+
+        /**
+         * @brief
+         * pool memory is freed once every acquired block is released
+         */
+        void            (*finalize)     (BufferPool* pool);
+    } BufferPoolClass;
+
+    BufferPoolClass*    buffer_pool_class_init      ();
+} // namespace util
+
+#endif
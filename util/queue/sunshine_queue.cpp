@@ -14,6 +14,7 @@
 #include <sunshine_object.h>
 #include <cstdlib>
 #include <mutex>
+#include <new>
 #include <string.h>
 
 #define BASE_SIZE 1024
@@ -31,6 +32,12 @@ namespace util {
          * 
          */
         BufferLL* first;
+
+        /**
+         * @brief 
+         * producer and consumer may be on different threads
+         */
+        std::mutex lock;
     };
 
 
@@ -91,6 +98,7 @@ namespace util {
         last->obj  = obj;
         last->next = NULL;
 
+        std::lock_guard<std::mutex> guard(queue->lock);
         if(!queue->first) {
             queue->first = last;
         } else {
@@ -106,6 +114,7 @@ namespace util {
     bool            
     queue_array_peek(QueueArray* queue)
     {
+        std::lock_guard<std::mutex> guard(queue->lock);
         return queue->first ? true : false;
     }
 
@@ -115,14 +124,17 @@ namespace util {
                     util::Buffer** buf,
                     int* size)
     {
-        if (!queue_array_peek(queue))
-            return NULL;
+        BufferLL* container = NULL;
+        {
+            std::lock_guard<std::mutex> guard(queue->lock);
+            container = queue->first;
+            if (!container)
+                return NULL;
+
+            queue->first = container->next;
+        }
 
-        BufferLL* container = queue->first;
         Buffer *ret = container->obj;
-
-
-        queue->first = container->next;
         free(container);
         *buf = ret;
         pointer data = BUFFER_CLASS->ref(ret,size);
@@ -138,6 +150,7 @@ namespace util {
         memset(array,0,sizeof(QueueArray));
 
         array->first = NULL;
+        new (&array->lock) std::mutex();
         return array;
     }
 
@@ -145,6 +158,7 @@ namespace util {
     void            
     queue_array_finalize(QueueArray* queue)
     {
+        queue->lock.~mutex();
         free(queue);
     }
 }
\ No newline at end of file
@@ -19,10 +19,14 @@
 #include <sunshine_macro.h>
 #include <sunshine_log.h>
 #include <sunshine_event.h>
+#include <sunshine_pool.h>
+#include <sunshine_cache.h>
 
 
 namespace rtp {
 typedef struct _RtpContext RtpContext;
+
+typedef struct _RtpOutput RtpOutput;
 }
 
 namespace encoder {
@@ -35,6 +39,8 @@ typedef struct _EncodeThreadContext EncodeThreadContext;
 typedef struct _Config  Config;
 
 typedef struct _Encoder Encoder;
+
+typedef struct _StripeGroup StripeGroup;
 }
 
 